@@ -6,6 +6,7 @@
 #endif
 #include <ESPAsyncWebServer.h>
 #include "fauxmoESP.h"
+#include "fauxmoWebHandler.h"
 
 // Rename the credentials.sample.h file to credentials.h and 
 // edit it according to your router configuration
@@ -51,14 +52,10 @@ void serverSetup() {
         request->send(200, "text/plain", "Hello, world");
     });
 
-    // These two callbacks are required for gen1 and gen3 compatibility
-    server.onRequestBody([](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-        if (fauxmo.process(request->client(), request->method() == HTTP_GET, request->url(), String((char *)data))) return;
-        // Handle any other body request here...
-    });
+    // Hue requests (/description.xml and /api/...) go to fauxmoESP, it is required for gen1 and gen3 compatibility
+    server.addHandler(new fauxmoWebHandler(fauxmo));
+
     server.onNotFound([](AsyncWebServerRequest *request) {
-        String body = (request->hasParam("body", true)) ? request->getParam("body", true)->value() : String();
-        if (fauxmo.process(request->client(), request->method() == HTTP_GET, request->url(), body)) return;
         // Handle not found request here...
     });
 
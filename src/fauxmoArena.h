@@ -0,0 +1,112 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+// Bump allocator for the transient buffers of a request (JSON documents,
+// response bodies). Everything is released at once with reset() after the
+// response is sent. The arena keeps one block that grows to the largest
+// request seen, up to max bytes, so once warmed up serving a request does not
+// touch the heap. Requests over max get the rest from the heap every time,
+// so a single large response does not pin that memory for the whole uptime.
+class fauxmoArena {
+
+    public:
+
+        fauxmoArena(size_t size, size_t max) : _size(size), _max(max) {}
+        ~fauxmoArena() { reset(); free(_block); }
+
+        // 4-byte aligned, NULL if out of memory
+        void * alloc(size_t size) {
+
+            size = (size + 3) & ~((size_t) 3);
+
+            // The block is allocated on first use, and again after growing
+            if (!_block && (_size > 0)) {
+                _block = (uint8_t *) malloc(_size);
+                if (!_block) _size = 0;
+            }
+            if (_used + size <= _size) {
+                void * p = _block + _used;
+                _used += size;
+                return p;
+            }
+
+            // Does not fit, take it from the heap until the next reset
+            overflow_t * chunk = (overflow_t *) malloc(sizeof(overflow_t) + size);
+            if (!chunk) return NULL;
+            chunk->next = _overflow;
+            _overflow = chunk;
+            _overflowSize += size;
+            return chunk + 1;
+
+        }
+
+        void reset() {
+
+            while (_overflow) {
+                overflow_t * next = _overflow->next;
+                free(_overflow);
+                _overflow = next;
+            }
+
+            // Grow to fit everything the last request needed, as far as the limit allows
+            size_t size = _size;
+            if (_overflowSize > 0) size = _used + _overflowSize;
+            if (size > _max) size = _max;
+            if (size != _size) {
+                free(_block);
+                _block = NULL;
+                _size = size;
+            }
+
+            _used = 0;
+            _overflowSize = 0;
+
+        }
+
+        size_t capacity() { return _size; }
+
+    private:
+
+        typedef struct overflow_t {
+            struct overflow_t * next;
+        } overflow_t;
+
+        uint8_t * _block = NULL;
+        size_t _size;
+        size_t _max;
+        size_t _used = 0;
+        overflow_t * _overflow = NULL;
+        size_t _overflowSize = 0;
+
+};
@@ -0,0 +1,286 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#include <Arduino.h>
+#include "fauxmoColors.h"
+
+// -----------------------------------------------------------------------------
+// Lookup tables
+// -----------------------------------------------------------------------------
+
+// Black body RGB every 8 mireds starting at 152 (Tanner Helland approximation)
+PROGMEM const uint8_t FAUXMO_COLOR_CT_LUT[][3] = {
+    {255,255,252}, {255,250,244}, {255,245,236}, {255,241,228}, {255,236,220}, {255,232,213},
+    {255,228,206}, {255,224,199}, {255,220,192}, {255,217,186}, {255,213,180}, {255,210,174},
+    {255,207,168}, {255,203,162}, {255,200,156}, {255,197,150}, {255,195,145}, {255,192,139},
+    {255,189,134}, {255,186,129}, {255,184,123}, {255,181,118}, {255,179,113}, {255,176,108},
+    {255,174,103}, {255,172, 98}, {255,170, 94}, {255,167, 89}, {255,165, 84}, {255,163, 79},
+    {255,161, 75}, {255,159, 70}, {255,157, 65}, {255,155, 61}, {255,153, 56}, {255,151, 52},
+    {255,150, 47}, {255,148, 43}, {255,146, 38}, {255,144, 34}, {255,143, 29}, {255,141, 25},
+    {255,139, 21}, {255,138, 16}, {255,136, 12}
+};
+
+// Linear to sRGB transfer function, 257 points over 0..65536, values are sRGB * 256
+PROGMEM const uint16_t FAUXMO_COLOR_GAMMA_LUT[257] = {
+        0,  3242,  5530,  7209,  8584,  9771, 10825, 11781, 12661, 13478, 14244, 14967,
+    15652, 16305, 16928, 17527, 18102, 18657, 19194, 19713, 20216, 20705, 21181, 21644,
+    22095, 22536, 22966, 23387, 23799, 24202, 24598, 24986, 25366, 25740, 26107, 26468,
+    26823, 27172, 27515, 27854, 28187, 28516, 28840, 29160, 29475, 29786, 30093, 30396,
+    30696, 30991, 31284, 31573, 31858, 32141, 32420, 32697, 32970, 33241, 33508, 33774,
+    34036, 34296, 34554, 34809, 35062, 35312, 35561, 35807, 36051, 36292, 36532, 36770,
+    37006, 37240, 37472, 37702, 37931, 38158, 38383, 38606, 38828, 39048, 39267, 39484,
+    39699, 39913, 40126, 40337, 40546, 40755, 40962, 41167, 41371, 41574, 41776, 41977,
+    42176, 42374, 42571, 42766, 42961, 43154, 43347, 43538, 43728, 43917, 44105, 44292,
+    44478, 44663, 44847, 45030, 45212, 45393, 45573, 45752, 45931, 46108, 46285, 46460,
+    46635, 46809, 46982, 47155, 47326, 47497, 47667, 47836, 48004, 48172, 48338, 48505,
+    48670, 48834, 48998, 49162, 49324, 49486, 49647, 49807, 49967, 50126, 50284, 50442,
+    50599, 50756, 50912, 51067, 51222, 51376, 51529, 51682, 51834, 51986, 52137, 52287,
+    52437, 52586, 52735, 52884, 53031, 53178, 53325, 53471, 53617, 53762, 53906, 54051,
+    54194, 54337, 54480, 54622, 54763, 54905, 55045, 55185, 55325, 55464, 55603, 55741,
+    55879, 56017, 56154, 56290, 56426, 56562, 56697, 56832, 56967, 57101, 57234, 57367,
+    57500, 57633, 57765, 57896, 58027, 58158, 58289, 58419, 58548, 58678, 58806, 58935,
+    59063, 59191, 59318, 59445, 59572, 59698, 59824, 59950, 60075, 60200, 60325, 60449,
+    60573, 60697, 60820, 60943, 61066, 61188, 61310, 61431, 61553, 61674, 61795, 61915,
+    62035, 62155, 62274, 62393, 62512, 62631, 62749, 62867, 62985, 63102, 63219, 63336,
+    63453, 63569, 63685, 63801, 63916, 64031, 64146, 64261, 64375, 64489, 64603, 64716,
+    64830, 64943, 65055, 65168, 65280
+};
+
+// round(65536 / d), entries 0 and 1 are not used
+PROGMEM const uint16_t FAUXMO_COLOR_RECIPROCAL_LUT[256] = {
+        0,     0, 32768, 21845, 16384, 13107, 10923,  9362,  8192,  7282,  6554,  5958,
+     5461,  5041,  4681,  4369,  4096,  3855,  3641,  3449,  3277,  3121,  2979,  2849,
+     2731,  2621,  2521,  2427,  2341,  2260,  2185,  2114,  2048,  1986,  1928,  1872,
+     1820,  1771,  1725,  1680,  1638,  1598,  1560,  1524,  1489,  1456,  1425,  1394,
+     1365,  1337,  1311,  1285,  1260,  1237,  1214,  1192,  1170,  1150,  1130,  1111,
+     1092,  1074,  1057,  1040,  1024,  1008,   993,   978,   964,   950,   936,   923,
+      910,   898,   886,   874,   862,   851,   840,   830,   819,   809,   799,   790,
+      780,   771,   762,   753,   745,   736,   728,   720,   712,   705,   697,   690,
+      683,   676,   669,   662,   655,   649,   643,   636,   630,   624,   618,   612,
+      607,   601,   596,   590,   585,   580,   575,   570,   565,   560,   555,   551,
+      546,   542,   537,   533,   529,   524,   520,   516,   512,   508,   504,   500,
+      496,   493,   489,   485,   482,   478,   475,   471,   468,   465,   462,   458,
+      455,   452,   449,   446,   443,   440,   437,   434,   431,   428,   426,   423,
+      420,   417,   415,   412,   410,   407,   405,   402,   400,   397,   395,   392,
+      390,   388,   386,   383,   381,   379,   377,   374,   372,   370,   368,   366,
+      364,   362,   360,   358,   356,   354,   352,   350,   349,   347,   345,   343,
+      341,   340,   338,   336,   334,   333,   331,   329,   328,   326,   324,   323,
+      321,   320,   318,   317,   315,   314,   312,   311,   309,   308,   306,   305,
+      303,   302,   301,   299,   298,   297,   295,   294,   293,   291,   290,   289,
+      287,   286,   285,   284,   282,   281,   280,   279,   278,   277,   275,   274,
+      273,   272,   271,   270,   269,   267,   266,   265,   264,   263,   262,   261,
+      260,   259,   258,   257
+};
+
+// -----------------------------------------------------------------------------
+// Helpers
+// -----------------------------------------------------------------------------
+
+// round(x / 255) for x in 0..65535
+static inline uint8_t _div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Hue API 0..254 to 0..255
+static inline uint8_t _scale254(uint8_t v) {
+    return (v >= 254) ? 255 : v + (v >> 7);
+}
+
+// x / d in Q16, d in 1..255
+static inline int32_t _divQ16(int32_t x, uint8_t d) {
+    if (d == 1) return x * 65536;
+    return x * (int32_t) pgm_read_word(&FAUXMO_COLOR_RECIPROCAL_LUT[d]);
+}
+
+// Linear 0..65535 to sRGB 0..255
+static inline uint8_t _gamma(uint32_t linear) {
+    uint16_t i = linear >> 8;
+    uint32_t a = pgm_read_word(&FAUXMO_COLOR_GAMMA_LUT[i]);
+    uint32_t b = pgm_read_word(&FAUXMO_COLOR_GAMMA_LUT[i + 1]);
+    return (a + (((b - a) * (linear & 0xFF)) >> 8) + 128) >> 8;
+}
+
+static inline void _write(uint8_t * out, fauxmo_rgb_t rgb, uint8_t channels) {
+    if (channels == 4) {
+        fauxmo_rgbw_t rgbw = fauxmo_rgb2rgbw(rgb);
+        out[0] = rgbw.r;
+        out[1] = rgbw.g;
+        out[2] = rgbw.b;
+        out[3] = rgbw.w;
+    } else {
+        out[0] = rgb.r;
+        out[1] = rgb.g;
+        out[2] = rgb.b;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Conversions
+// -----------------------------------------------------------------------------
+
+fauxmo_rgb_t fauxmo_hs2rgb(uint16_t hue, uint8_t sat, uint8_t bri) {
+
+    uint8_t s = _scale254(sat);
+    uint8_t v = _scale254(bri);
+
+    // Six sectors, f is the 8-bit position inside the sector
+    uint32_t h6 = (uint32_t) hue * 6;
+    uint8_t sector = h6 >> 16;
+    uint8_t f = (h6 >> 8) & 0xFF;
+
+    uint8_t p = _div255(v * (255 - s));
+    uint8_t q = _div255(v * (255 - _div255(s * f)));
+    uint8_t t = _div255(v * (255 - _div255(s * (255 - f))));
+
+    switch (sector) {
+        case 0: return {v, t, p};
+        case 1: return {q, v, p};
+        case 2: return {p, v, t};
+        case 3: return {p, q, v};
+        case 4: return {t, p, v};
+        default: return {v, p, q};
+    }
+
+}
+
+void fauxmo_rgb2hs(fauxmo_rgb_t rgb, uint16_t * hue, uint8_t * sat) {
+
+    uint8_t max = rgb.r > rgb.g ? (rgb.r > rgb.b ? rgb.r : rgb.b) : (rgb.g > rgb.b ? rgb.g : rgb.b);
+    uint8_t min = rgb.r < rgb.g ? (rgb.r < rgb.b ? rgb.r : rgb.b) : (rgb.g < rgb.b ? rgb.g : rgb.b);
+    uint8_t delta = max - min;
+
+    if (0 == delta) {
+        *hue = 0;
+        *sat = 0;
+        return;
+    }
+
+    *sat = (_divQ16(delta * 254, max) + 32768) >> 16;
+
+    // Position around the circle in sectors (Q16), then divide by 6
+    int32_t h;
+    if (max == rgb.r) {
+        h = _divQ16((int32_t) rgb.g - rgb.b, delta);
+    } else if (max == rgb.g) {
+        h = 2 * 65536 + _divQ16((int32_t) rgb.b - rgb.r, delta);
+    } else {
+        h = 4 * 65536 + _divQ16((int32_t) rgb.r - rgb.g, delta);
+    }
+    if (h < 0) h += 6 * 65536;
+    *hue = (uint32_t) h / 6;
+
+}
+
+fauxmo_rgb_t fauxmo_ct2rgb(uint16_t mireds, uint8_t bri) {
+
+    if (mireds < FAUXMO_COLOR_CT_MIN) mireds = FAUXMO_COLOR_CT_MIN;
+    if (mireds > FAUXMO_COLOR_CT_MAX) mireds = FAUXMO_COLOR_CT_MAX;
+
+    uint8_t i = (mireds - 152) >> 3;
+    uint8_t f = (mireds - 152) & 0x07;
+    uint8_t v = _scale254(bri);
+
+    uint8_t c[3];
+    for (uint8_t k = 0; k < 3; k++) {
+        int16_t a = pgm_read_byte(&FAUXMO_COLOR_CT_LUT[i][k]);
+        int16_t b = pgm_read_byte(&FAUXMO_COLOR_CT_LUT[i + 1][k]);
+        c[k] = _div255((a + (((b - a) * f) >> 3)) * v);
+    }
+
+    return {c[0], c[1], c[2]};
+
+}
+
+fauxmo_rgb_t fauxmo_xy2rgb(uint16_t x, uint16_t y, uint8_t bri) {
+
+    // XYZ scaled by y (so Y = y), the result is normalized to the brightest
+    // channel anyway so there is no need to divide by y
+    int32_t X = x;
+    int32_t Y = y;
+    int32_t Z = 65535 - X - Y;
+    if (Z < 0) Z = 0;
+
+    // Wide gamut D65 conversion matrix (Q12)
+    int32_t c[3];
+    c[0] = ( X * 6785 - Y * 1453 - Z * 1045) >> 12;
+    c[1] = (-X * 2897 + Y * 6781 + Z *  148) >> 12;
+    c[2] = ( X *  212 - Y *  497 + Z * 4143) >> 12;
+
+    int32_t max = 0;
+    for (uint8_t k = 0; k < 3; k++) {
+        if (c[k] < 0) c[k] = 0;
+        if (c[k] > max) max = c[k];
+    }
+    if (0 == max) return {0, 0, 0};
+
+    // Normalize to 16 bits and stretch the brightest channel to full scale
+    while (max > 0xFFFF) {
+        max >>= 1;
+        for (uint8_t k = 0; k < 3; k++) c[k] >>= 1;
+    }
+    uint32_t inv = (0xFFFFUL << 16) / max;
+    uint8_t v = _scale254(bri);
+
+    uint8_t out[3];
+    for (uint8_t k = 0; k < 3; k++) {
+        out[k] = _div255(_gamma(((uint32_t) c[k] * inv) >> 16) * v);
+    }
+
+    return {out[0], out[1], out[2]};
+
+}
+
+fauxmo_rgbw_t fauxmo_rgb2rgbw(fauxmo_rgb_t rgb) {
+    uint8_t w = rgb.r < rgb.g ? (rgb.r < rgb.b ? rgb.r : rgb.b) : (rgb.g < rgb.b ? rgb.g : rgb.b);
+    return {(uint8_t) (rgb.r - w), (uint8_t) (rgb.g - w), (uint8_t) (rgb.b - w), w};
+}
+
+fauxmo_rgb_t fauxmo_color2rgb(const fauxmo_color_t * color) {
+    if (color->mode == 'c') return fauxmo_ct2rgb(color->ct, color->bri);
+    if (color->mode == 'x') return fauxmo_xy2rgb(color->x, color->y, color->bri);
+    return fauxmo_hs2rgb(color->hue, color->sat, color->bri);
+}
+
+// -----------------------------------------------------------------------------
+// Batch
+// -----------------------------------------------------------------------------
+
+void fauxmo_hs2rgb_n(const uint16_t * hue, const uint8_t * sat, const uint8_t * bri, uint8_t * out, size_t count, uint8_t channels) {
+    for (size_t i = 0; i < count; i++) {
+        _write(out, fauxmo_hs2rgb(hue[i], sat[i], bri[i]), channels);
+        out += channels;
+    }
+}
+
+void fauxmo_color2rgb_n(const fauxmo_color_t * colors, uint8_t * out, size_t count, uint8_t channels) {
+    for (size_t i = 0; i < count; i++) {
+        _write(out, fauxmo_color2rgb(&colors[i]), channels);
+        out += channels;
+    }
+}
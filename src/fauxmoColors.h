@@ -0,0 +1,82 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Color conversions between the Hue representations (hue/sat, mireds and
+// CIE xy) and 8-bit RGB/RGBW. Everything is integer or fixed point so it is
+// cheap on cores without an FPU (ESP8266, RP2040).
+//
+// Ranges follow the Hue API:
+//   hue        0..65535 (full circle)
+//   sat, bri   0..254
+//   mireds     153..500 (values outside are clamped)
+//   x, y       0..65535 representing 0.0..1.0
+// RGB output is 0..255 per channel.
+
+#define FAUXMO_COLOR_CT_MIN         153
+#define FAUXMO_COLOR_CT_MAX         500
+
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} fauxmo_rgb_t;
+
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t w;
+} fauxmo_rgbw_t;
+
+// Generic color, the same fields fauxmoesp_device_t keeps for a device
+typedef struct {
+    char mode;          // 'h' (hue/sat), 'c' (color temperature) or 'x' (xy)
+    uint8_t bri;
+    uint16_t hue;
+    uint8_t sat;
+    uint16_t ct;
+    uint16_t x;
+    uint16_t y;
+} fauxmo_color_t;
+
+fauxmo_rgb_t fauxmo_hs2rgb(uint16_t hue, uint8_t sat, uint8_t bri);
+void fauxmo_rgb2hs(fauxmo_rgb_t rgb, uint16_t * hue, uint8_t * sat);
+fauxmo_rgb_t fauxmo_ct2rgb(uint16_t mireds, uint8_t bri);
+fauxmo_rgb_t fauxmo_xy2rgb(uint16_t x, uint16_t y, uint8_t bri);
+fauxmo_rgbw_t fauxmo_rgb2rgbw(fauxmo_rgb_t rgb);
+fauxmo_rgb_t fauxmo_color2rgb(const fauxmo_color_t * color);
+
+// Batch conversions to interleaved pixel buffers, channels is 3 (RGB) or 4 (RGBW).
+// out must hold count * channels bytes.
+void fauxmo_hs2rgb_n(const uint16_t * hue, const uint8_t * sat, const uint8_t * bri, uint8_t * out, size_t count, uint8_t channels);
+void fauxmo_color2rgb_n(const fauxmo_color_t * colors, uint8_t * out, size_t count, uint8_t channels);
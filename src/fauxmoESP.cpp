@@ -29,26 +29,149 @@ THE SOFTWARE.
 #include <Arduino.h>
 #include "fauxmoESP.h"
 
+// Hue type names and fields each device type supports, by fauxmoesp_device_type_t
+const char * const fauxmoESP::_typeNames[] = {
+    "On/Off plug-in unit", "Dimmable light", "Color temperature light", "Extended color light"
+};
+const unsigned char fauxmoESP::_typeFields[] = {
+    FAUXMO_CHANGE_STATE,
+    FAUXMO_CHANGE_STATE | FAUXMO_CHANGE_VALUE,
+    FAUXMO_CHANGE_STATE | FAUXMO_CHANGE_VALUE | FAUXMO_CHANGE_CT,
+    FAUXMO_CHANGE_ALL
+};
+
+// -----------------------------------------------------------------------------
+// Bitsets
+// -----------------------------------------------------------------------------
+
+static inline bool _bitGet(const std::vector<uint32_t> & bits, unsigned int i) {
+	return ((i >> 5) < bits.size()) && (bits[i >> 5] & (1UL << (i & 31)));
+}
+
+static inline void _bitSet(std::vector<uint32_t> & bits, unsigned int i, bool value) {
+	if ((i >> 5) >= bits.size()) {
+		if (!value) return;
+		bits.resize((i >> 5) + 1, 0);
+	}
+	if (value) {
+		bits[i >> 5] |= (1UL << (i & 31));
+	} else {
+		bits[i >> 5] &= ~(1UL << (i & 31));
+	}
+}
+
+// Removes bit i, moving the ones above it down one position
+static inline void _bitErase(std::vector<uint32_t> & bits, unsigned int i) {
+	unsigned int count = bits.size() * 32;
+	for (; i + 1 < count; i++) _bitSet(bits, i, _bitGet(bits, i + 1));
+	if (count > 0) _bitSet(bits, count - 1, false);
+}
+
+// -----------------------------------------------------------------------------
+// Bridges
+// -----------------------------------------------------------------------------
+
+unsigned char fauxmoESP::_bridgeLimit() {
+	// One port per bridge from _tcp_port, none of them past 65535
+	if (_tcp_port >= 65535) return 1;
+	return std::min((unsigned long) FAUXMO_MAX_BRIDGES, 65536UL - _tcp_port);
+}
+
+unsigned char fauxmoESP::_bridgeCount() {
+	if ((0 == _devicesPerBridge) || (_devices.size() <= _devicesPerBridge)) return 1;
+	size_t count = (_devices.size() + _devicesPerBridge - 1) / _devicesPerBridge;
+	return std::min(count, (size_t) _bridgeLimit());
+}
+
+uint16_t fauxmoESP::_bridgeFirst(unsigned char bridge) {
+	return bridge * _devicesPerBridge;
+}
+
+uint16_t fauxmoESP::_bridgeSize(unsigned char bridge) {
+	if (0 == _devicesPerBridge) return _devices.size();
+	uint16_t first = _bridgeFirst(bridge);
+	if (first >= _devices.size()) return 0;
+	if (bridge + 1 >= _bridgeCount()) return _devices.size() - first;    // the last one takes the rest
+	return std::min((size_t) _devicesPerBridge, _devices.size() - first);
+}
+
+bool fauxmoESP::_groupOnBridge(unsigned char group, unsigned char bridge) {
+	uint16_t first = _bridgeFirst(bridge);
+	uint16_t size = _bridgeSize(bridge);
+	for (uint16_t i = first; i < first + size; i++) {
+		if (_bitGet(_groups[group].members, i)) return true;
+	}
+	return false;
+}
+
+const char * fauxmoESP::_macAddress() {
+
+	// WiFi.macAddress() builds a String every time, cache it once the interface has a real one
+	if ((0 == _mac[0]) || (strcmp(_mac, "00:00:00:00:00:00") == 0)) {
+		strncpy(_mac, WiFi.macAddress().c_str(), sizeof(_mac) - 1);
+	}
+	return _mac;
+
+}
+
+void fauxmoESP::_bridgeId(unsigned char bridge, char * buffer) {
+
+	// Lowercase MAC without separators, bridges other than #0 change the last byte
+	unsigned char n = 0;
+	for (const char * p = _macAddress(); *p && (n < 12); p++) {
+		if (*p != ':') buffer[n++] = tolower(*p);
+	}
+	buffer[n] = 0;
+
+	if (bridge > 0) {
+		uint8_t last = strtoul(buffer + 10, NULL, 16);
+		snprintf(buffer + 10, 3, "%02x", (uint8_t) (last + bridge));
+	}
+
+}
+
+void fauxmoESP::_startServers() {
+
+	unsigned char count = _bridgeCount();
+	for (unsigned char bridge = 0; bridge < count; bridge++) {
+
+		if (bridge >= _servers.size()) _servers.push_back(NULL);
+
+		// Bridge #0 requests come through process() when using an external server
+		if ((0 == bridge) && !_internal) continue;
+
+		if (NULL == _servers[bridge]) {
+			_servers[bridge] = new AsyncServer(_tcp_port + bridge);
+			_servers[bridge]->onClient([this, bridge](void *s, AsyncClient* c) {
+				_onTCPClient(c, bridge);
+			}, 0);
+			DEBUG_MSG_FAUXMO("[FAUXMO] Bridge #%d listening on port %d\n", bridge, _tcp_port + bridge);
+		}
+		_servers[bridge]->begin();
+
+	}
+
+}
+
 // -----------------------------------------------------------------------------
 // UDP
 // -----------------------------------------------------------------------------
 
-void fauxmoESP::_sendUDPResponse() {
+void fauxmoESP::_sendUDPResponse(unsigned char bridge) {
 
-	DEBUG_MSG_FAUXMO("[FAUXMO] Responding to M-SEARCH request\n");
+	DEBUG_MSG_FAUXMO("[FAUXMO] Responding to M-SEARCH request for bridge #%d\n", bridge);
 
 	IPAddress ip = WiFi.localIP();
-    String mac = WiFi.macAddress();
-    mac.replace(":", "");
-    mac.toLowerCase();
+	char mac[13];
+	_bridgeId(bridge, mac);
 
 	char response[strlen(FAUXMO_UDP_RESPONSE_TEMPLATE) + 128];
     snprintf_P(
         response, sizeof(response),
         FAUXMO_UDP_RESPONSE_TEMPLATE,
         ip[0], ip[1], ip[2], ip[3],
-		_tcp_port,
-        mac.c_str(), mac.c_str()
+		_tcp_port + bridge,
+        mac, mac
     );
 
 	#if DEBUG_FAUXMO_VERBOSE_UDP
@@ -78,10 +201,12 @@ void fauxmoESP::_handleUDP() {
 			DEBUG_MSG_FAUXMO("[FAUXMO] UDP packet received\n%s", (const char *) data);
 		#endif
 
-        String request = (const char *) data;
-        if (request.indexOf("M-SEARCH") >= 0) {
-            if ((request.indexOf("ssdp:discover") > 0) || (request.indexOf("upnp:rootdevice") > 0) || (request.indexOf("device:basic:1") > 0)) {
-                _sendUDPResponse();
+        const char * request = (const char *) data;
+        if (_indexOf(request, "M-SEARCH") >= 0) {
+            if ((_indexOf(request, "ssdp:discover") > 0) || (_indexOf(request, "upnp:rootdevice") > 0) || (_indexOf(request, "device:basic:1") > 0)) {
+                for (unsigned char bridge = 0; bridge < _bridgeCount(); bridge++) {
+                    _sendUDPResponse(bridge);
+                }
             }
         }
     }
@@ -93,7 +218,7 @@ void fauxmoESP::_handleUDP() {
 // TCP
 // -----------------------------------------------------------------------------
 
-void fauxmoESP::_sendTCPResponse(AsyncClient *client, const char * code, char * body, const char * mime) {
+void fauxmoESP::_sendTCPResponse(AsyncClient *client, const char * code, const char * body, const char * mime) {
 
 	char headers[strlen_P(FAUXMO_TCP_HEADERS) + 32];
 	snprintf_P(
@@ -111,99 +236,150 @@ void fauxmoESP::_sendTCPResponse(AsyncClient *client, const char * code, char *
 
 }
 
-String fauxmoESP::_deviceJson(unsigned char id, bool all = true) {
-    if (id >= _devices.size()) return "{}";
-
-    fauxmoesp_device_t device = _devices[id];
+int fauxmoESP::_deviceJsonFormat(char * buffer, size_t size, uint16_t id, const fauxmoesp_state_t & device, bool all) {
 
-    DEBUG_MSG_FAUXMO("[FAUXMO] Sending device info for \"%s\", uniqueID = \"%s\", complete_info = %s\n",
-                     device.name, device.uniqueid, all ? "true" : "false");
+    const char * name = _devices[id].name;
+    const char * uniqueid = _devices[id].uniqueid;
 
-    // Step 1: Calculate the required buffer size dynamically
-    int needed_size;
-    if (all) {
-        needed_size = snprintf(NULL, 0, FAUXMO_DEVICE_JSON_TEMPLATE,
-                               device.name, device.uniqueid,
-                               device.state ? "true" : "false",
-                               device.value, device.hue, device.sat, device.colorTemp,
-                               (device.mode == 'h' ? "hs" : device.mode == 'c' ? "ct" : "xy")) + 1;
-    } else {
-        needed_size = snprintf(NULL, 0, FAUXMO_DEVICE_JSON_TEMPLATE_SHORT,
-                               device.name, device.uniqueid) + 1;
+    // The short description does not use the state
+    if (!all) {
+        return snprintf(buffer, size, FAUXMO_DEVICE_JSON_TEMPLATE_SHORT,
+                        _typeNames[_devices[id].type], name, uniqueid);
     }
 
-    // Step 2: Allocate buffer dynamically
-    char* buffer = (char*)malloc(needed_size);
-    if (!buffer) return "{}";  // Return empty JSON if memory allocation fails
+    const char * on = device.state ? "true" : "false";
+
+    switch (_devices[id].type) {
+
+        case FAUXMO_DEVICE_ONOFF:
+            return snprintf(buffer, size, FAUXMO_ONOFF_JSON_TEMPLATE,
+                            name, uniqueid, on);
+
+        case FAUXMO_DEVICE_DIMMABLE:
+            return snprintf(buffer, size, FAUXMO_DIMMABLE_JSON_TEMPLATE,
+                            name, uniqueid, on, device.value);
+
+        case FAUXMO_DEVICE_CT:
+            return snprintf(buffer, size, FAUXMO_CT_JSON_TEMPLATE,
+                            name, uniqueid, on, device.value, device.colorTemp);
+
+        default:
+            break;
 
-    // Step 3: Fill the buffer with formatted data
-    if (all) {
-        snprintf(buffer, needed_size, FAUXMO_DEVICE_JSON_TEMPLATE,
-                 device.name, device.uniqueid,
-                 device.state ? "true" : "false",
-                 device.value, device.hue, device.sat, device.colorTemp,
-                 (device.mode == 'h' ? "hs" : device.mode == 'c' ? "ct" : "xy"));
-    } else {
-        snprintf(buffer, needed_size, FAUXMO_DEVICE_JSON_TEMPLATE_SHORT,
-                 device.name, device.uniqueid);
     }
 
-    // Step 4: Convert to `String` and free memory
-    String jsonString = String(buffer);
-    free(buffer);
+    // CIE xy coordinates as decimals with four digits
+    unsigned int x = ((uint32_t) device.x * 10000 + 32767) / 65535;
+    unsigned int y = ((uint32_t) device.y * 10000 + 32767) / 65535;
+
+    return snprintf(buffer, size, FAUXMO_DEVICE_JSON_TEMPLATE,
+                    name, uniqueid, on,
+                    device.value, device.hue, device.sat, device.colorTemp,
+                    x / 10000, x % 10000, y / 10000, y % 10000,
+                    (device.mode == 'h' ? "hs" : device.mode == 'c' ? "ct" : "xy"));
 
-    return jsonString;
 }
 
+char * fauxmoESP::_deviceJson(uint16_t id, bool all = true) {
+    if (id >= _devices.size()) return (char *) "{}";
 
-String fauxmoESP::_byte2hex(uint8_t zahl)
-{
-  String hstring = String(zahl, HEX);
-  if (zahl < 16)
-  {
-    hstring = "0" + hstring;
-  }
+    fauxmoesp_state_t device;
+    _readState(id, device);
 
-  return hstring;
+    DEBUG_MSG_FAUXMO("[FAUXMO] Sending device info for \"%s\", uniqueID = \"%s\", complete_info = %s\n",
+                     _devices[id].name, _devices[id].uniqueid, all ? "true" : "false");
+
+    // Step 1: Calculate the required buffer size dynamically
+    int needed_size = _deviceJsonFormat(NULL, 0, id, device, all) + 1;
+
+    // Step 2: Allocate buffer in the request arena
+    char* buffer = (char*)_arena.alloc(needed_size);
+    if (!buffer) return (char *) "{}";  // Return empty JSON if memory allocation fails
+
+    // Step 3: Fill the buffer with formatted data, it lives until the response is sent
+    _deviceJsonFormat(buffer, needed_size, id, device, all);
+
+    return buffer;
 }
 
-String fauxmoESP::_makeMD5(String text)
-{
-  unsigned char bbuf[16];
-  String hash = "";
-  MD5Builder md5;
-  md5.begin();
-  md5.add(text);
-  md5.calculate();
-  
-  md5.getBytes(bbuf);
-  for (uint8_t i = 0; i < 16; i++)
-  {
-    hash += _byte2hex(bbuf[i]);
-  }
 
-  return hash;
+char * fauxmoESP::_groupJson(unsigned char id, unsigned char bridge) {
+    if (id >= _groups.size()) return (char *) "{}";
+
+    fauxmoesp_group_t & group = _groups[id];
+
+    // Members in this bridge as a list of light ids ("1","3"), and their aggregated state
+    uint16_t first = _bridgeFirst(bridge);
+    uint16_t size = _bridgeSize(bridge);
+    char * lights = (char *) _arena.alloc(size * 8 + 1);
+    if (!lights) return (char *) "{}";
+    char * p = lights;
+    *p = 0;
+    bool any_on = false;
+    bool all_on = true;
+    unsigned char value = 0;
+    for (unsigned int i = 0; i < size; i++) {
+        if (!_bitGet(group.members, first + i)) continue;
+        fauxmoesp_state_t state;
+        _readState(first + i, state);
+        if (p > lights) {
+            *p++ = ',';
+        } else {
+            value = state.value;
+        }
+        p += sprintf(p, "\"%u\"", i + 1);
+        any_on |= state.state;
+        all_on &= state.state;
+    }
+    if (p == lights) all_on = false;
+
+    int needed_size = snprintf(NULL, 0, FAUXMO_GROUP_JSON_TEMPLATE,
+                               group.name, lights,
+                               any_on ? "true" : "false", value,
+                               all_on ? "true" : "false", any_on ? "true" : "false") + 1;
+
+    char* buffer = (char*)_arena.alloc(needed_size);
+    if (!buffer) return (char *) "{}";
+
+    snprintf(buffer, needed_size, FAUXMO_GROUP_JSON_TEMPLATE,
+             group.name, lights,
+             any_on ? "true" : "false", value,
+             all_on ? "true" : "false", any_on ? "true" : "false");
+
+    return buffer;
+}
+
+int fauxmoESP::_indexOf(const char * haystack, const char * needle, int from) {
+    const char * found = strstr(haystack + from, needle);
+    return found ? (found - haystack) : -1;
+}
+
+int fauxmoESP::_toInt(const char * text, int from) {
+    // Like String::substring(from).toInt(), without reading past the end of the text
+    for (int i = 0; i < from; i++) {
+        if (0 == text[i]) return 0;
+    }
+    return atoi(text + from);
 }
 
-bool fauxmoESP::_onTCPDescription(AsyncClient *client, String url, String body) {
+bool fauxmoESP::_onTCPDescription(AsyncClient *client, unsigned char bridge, const char * url, const char * body) {
 
 	(void) url;
 	(void) body;
 
-	DEBUG_MSG_FAUXMO("[FAUXMO] Handling /description.xml request\n");
+	DEBUG_MSG_FAUXMO("[FAUXMO] Handling /description.xml request for bridge #%d\n", bridge);
 
 	IPAddress ip = WiFi.localIP();
-    String mac = WiFi.macAddress();
-    mac.replace(":", "");
-    mac.toLowerCase();
+	char mac[13];
+	_bridgeId(bridge, mac);
 
 	char response[strlen_P(FAUXMO_DESCRIPTION_TEMPLATE) + 64];
     snprintf_P(
         response, sizeof(response),
         FAUXMO_DESCRIPTION_TEMPLATE,
-        ip[0], ip[1], ip[2], ip[3], _tcp_port,
-        ip[0], ip[1], ip[2], ip[3], _tcp_port,
-        mac.c_str(), mac.c_str()
+        ip[0], ip[1], ip[2], ip[3], _tcp_port + bridge,
+        ip[0], ip[1], ip[2], ip[3], _tcp_port + bridge,
+        mac, mac
     );
 
 	_sendTCPResponse(client, "200 OK", response, "text/xml");
@@ -213,241 +389,492 @@ bool fauxmoESP::_onTCPDescription(AsyncClient *client, String url, String body)
 }
 
 
-bool fauxmoESP::_onTCPList(AsyncClient *client, String url, String body) {
-	DEBUG_MSG_FAUXMO("[FAUXMO] Handling list request for: url=%s, body=%s\n", url.c_str(), body.c_str());
+bool fauxmoESP::_onTCPList(AsyncClient *client, unsigned char bridge, const char * url, const char * body) {
+	DEBUG_MSG_FAUXMO("[FAUXMO] Handling list request for: url=%s, body=%s\n", url, body);
 
 	// Get the index
-	int pos = url.indexOf("lights");
+	int pos = _indexOf(url, "lights");
 	if (-1 == pos) return false;
 
-	// Get the id
-	unsigned char id = url.substring(pos+7).toInt();
+	// Get the id, local to this bridge
+	uint16_t id = _toInt(url, pos + 7);
+	uint16_t first = _bridgeFirst(bridge);
+	uint16_t size = _bridgeSize(bridge);
 
 
-	// This will hold the response string	
-	String response;
+	// This will hold the response string, in the request arena
+	const char * response;
 
 	// Client is requesting all devices
 	if (0 == id) {
 		DEBUG_MSG_FAUXMO("[FAUXMO] Sending all devices\n");
-		response += "{";
-		for (unsigned char i=0; i< _devices.size(); i++) {
-			if (i>0) response += ",";
-			response += "\"" + String(i+1) + "\":" + _deviceJson(i, false);	// send short template
+
+		// Short template for each device, the buffer is sized from the template and names
+		// so every description is formatted once, straight into the response
+		size_t len = 3;
+		for (uint16_t i=0; i< size; i++) {
+			len += sizeof(FAUXMO_DEVICE_JSON_TEMPLATE_SHORT) + strlen(_devices[first + i].name) + FAUXMO_DEVICE_UNIQUE_ID_LENGTH + 32;
+		}
+		char * buffer = (char *) _arena.alloc(len);
+		if (!buffer) return false;
+
+		char * p = buffer;
+		char * end = buffer + len;
+		fauxmoesp_state_t none = {};
+		*p++ = '{';
+		for (uint16_t i=0; i< size; i++) {
+			p += snprintf(p, end - p, "%s\"%u\":", (i > 0) ? "," : "", i + 1);
+			p += _deviceJsonFormat(p, end - p, first + i, none, false);
 		}
-		response += "}";
+		*p++ = '}';
+		*p = 0;
+		response = buffer;
 
 	// Client is requesting a single device
 	} else {
 		DEBUG_MSG_FAUXMO("[FAUXMO] Sending device %d\n", id);
-		response = _deviceJson(id-1);
+		response = (id <= size) ? _deviceJson(first + id - 1) : "{}";
 	}
 
-	_sendTCPResponse(client, "200 OK", (char *) response.c_str(), "application/json");
-	DEBUG_MSG_FAUXMO("[FAUXMO] Response: %s\n", response.c_str());
+	_sendTCPResponse(client, "200 OK", response, "application/json");
+	DEBUG_MSG_FAUXMO("[FAUXMO] Response: %s\n", response);
 	
 	return true;
 
 }
 
-// byte* fauxmoESP::_hs2rgb(uint16_t hue, uint8_t sat) {
-// 	byte *rgb = new byte[3]{0, 0, 0};
-
-// 	float h = ((float)hue)/65535.0;
-//     float s = ((float)sat)/255.0;
-
-//     byte i = floor(h*6);
-//     float f = h * 6-i;
-//     float p = 255 * (1-s);
-//     float q = 255 * (1-f*s);
-//     float t = 255 * (1-(1-f)*s);
-//     switch (i%6) {
-//       case 0: rgb[0]=255,rgb[1]=t,rgb[2]=p;break;
-//       case 1: rgb[0]=q,rgb[1]=255,rgb[2]=p;break;
-//       case 2: rgb[0]=p,rgb[1]=255,rgb[2]=t;break;
-//       case 3: rgb[0]=p,rgb[1]=q,rgb[2]=255;break;
-//       case 4: rgb[0]=t,rgb[1]=p,rgb[2]=255;break;
-//       case 5: rgb[0]=255,rgb[1]=p,rgb[2]=q;
-//     }
-// 	return rgb;
-// }
-
-
-// uint16_t* fauxmoESP::_rgb2hs(byte r, byte g, byte b) {
-//     // ✅ Allocate an array for Hue (16-bit) and Saturation (8-bit)
-//     uint16_t* hs = new uint16_t[2]{0, 0}; 
-
-//     // Normalize RGB values to [0, 1]
-//     float rf = r / 255.0;
-//     float gf = g / 255.0;
-//     float bf = b / 255.0;
-
-//     // Get max and min values of RGB
-//     float maxVal = max(rf, max(gf, bf));
-//     float minVal = min(rf, min(gf, bf));
-//     float delta = maxVal - minVal;
-
-//     // ✅ Calculate Hue correctly
-//     float h = 0;
-//     if (delta > 0) {
-//         if (maxVal == rf) {
-//             h = fmod(((gf - bf) / delta), 6.0);
-//             if (h < 0) h += 6.0; // Ensure positive hue
-//         } else if (maxVal == gf) {
-//             h = ((bf - rf) / delta) + 2.0;
-//         } else {
-//             h = ((rf - gf) / delta) + 4.0;
-//         }
-//         h *= 60.0; // Convert to degrees
-//     }
-
-//     // ✅ Calculate Saturation correctly
-//     float s = (maxVal > 0) ? (delta / maxVal) : 0;
-
-//     // ✅ Scale results correctly
-//     hs[0] = (uint16_t)((h / 360.0) * 65534.0); // Scale hue to 0-65534
-//     hs[1] = (uint8_t)(s * 254.0);  // Scale saturation to 0-254
-
-//     // ✅ Ensure values are within valid range
-//     if (hs[1] == 0) hs[1] = 1;
-//     if (hs[1] == 255) hs[1] = 254;
-//     if (hs[0] == 0) hs[0] = 1;
-//     if (hs[0] == 65535) hs[0] = 65534;
-
-//     return hs; // ✅ Correctly return uint16_t* (16-bit array)
-// }
-
-bool fauxmoESP::_onTCPControl(AsyncClient *client, String url, String body) {
+uint16_t fauxmoESP::_parseUnit(const char * p) {
+
+	// Parses a decimal in the 0..1 range ("0.3227") to 0..65535 without floats
+	while (*p == ' ') p++;
+
+	uint32_t integer = 0;
+	while ((*p >= '0') && (*p <= '9')) integer = integer * 10 + (*p++ - '0');
+	if (integer > 0) return 65535;
+
+	uint32_t fraction = 0;
+	uint32_t scale = 1;
+	if (*p == '.') {
+		p++;
+		while ((*p >= '0') && (*p <= '9') && (scale < 10000)) {
+			fraction = fraction * 10 + (*p++ - '0');
+			scale *= 10;
+		}
+	}
+
+	return (fraction * 65535 + scale / 2) / scale;
+
+}
+
+void fauxmoESP::_readState(uint16_t id, fauxmoesp_state_t & state) {
+
+    // Seqlock reader: copy the words and retry if the counter was odd (write in progress) or changed
+    fauxmoesp_device_t & device = _devices[id];
+    uint32_t words[FAUXMO_STATE_WORDS];
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&device.seq, __ATOMIC_ACQUIRE);
+        for (size_t i = 0; i < FAUXMO_STATE_WORDS; i++) {
+            words[i] = __atomic_load_n(&device.data[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&device.seq, __ATOMIC_RELAXED)));
+
+    memcpy(&state, words, sizeof(state));
+
+}
+
+void fauxmoESP::_writeState(uint16_t id, const fauxmoesp_state_t & state) {
+
+    // Seqlock writer, the caller holds FAUXMO_WRITER_LOCK so there is a single writer
+    fauxmoesp_device_t & device = _devices[id];
+    uint32_t words[FAUXMO_STATE_WORDS] = {0};
+    memcpy(words, &state, sizeof(state));
+
+    uint32_t seq = __atomic_load_n(&device.seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&device.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t i = 0; i < FAUXMO_STATE_WORDS; i++) {
+        __atomic_store_n(&device.data[i], words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&device.seq, seq + 2, __ATOMIC_RELEASE);
+
+}
+
+void fauxmoESP::_parseChange(const char * body, fauxmoesp_change_t & change) {
+
+    int pos;
+    change.fields = 0;
+
+    // Transition time, in 100ms steps
+    change.transition = _defaultTransition;
+    if ((pos = _indexOf(body, "transitiontime")) > 0) {
+        change.transition = _toInt(body, pos + 16);
+    }
+
+    if (_indexOf(body, "\"xy\"") > 0) {
+        change.mode = 'x'; // XY mode
+    } else if (_indexOf(body, "\"ct\"") > 0) {
+        change.mode = 'c'; // Color temperature mode
+    } else {
+        change.mode = 'h'; // Hue/Saturation mode
+    }
+
+    if (_indexOf(body, "false") > 0) {
+        change.fields |= FAUXMO_CHANGE_STATE;
+        change.state = false;
+    } else if (_indexOf(body, "true") > 0) {
+        change.fields |= FAUXMO_CHANGE_STATE;
+        change.state = true;
+    }
+
+    // Brightness
+    if ((pos = _indexOf(body, "bri")) > 0) {
+        unsigned char value = _toInt(body, pos + 5);
+        if (value == 255) value = 254;
+        change.fields |= FAUXMO_CHANGE_VALUE;
+        change.value = value;
+    }
+
+    // Hue and Saturation
+    if ((pos = _indexOf(body, "hue")) > 0) {
+        change.hue = _toInt(body, pos + 5);
+        pos = _indexOf(body, "sat", pos);
+        change.sat = (pos > 0) ? _toInt(body, pos + 5) : 0;
+        change.fields |= FAUXMO_CHANGE_HUE;
+    }
+
+    // CIE xy, also translated to hue and saturation for the color callbacks
+    if ((pos = _indexOf(body, "\"xy\"")) > 0) {
+        pos = _indexOf(body, "[", pos);
+        int pos_comma = (pos > 0) ? _indexOf(body, ",", pos) : -1;
+        if ((pos > 0) && (pos_comma > 0)) {
+            change.x = _parseUnit(body + pos + 1);
+            change.y = _parseUnit(body + pos_comma + 1);
+            fauxmo_rgb2hs(fauxmo_xy2rgb(change.x, change.y, 254), &change.hue, &change.sat);
+            change.fields |= FAUXMO_CHANGE_XY;
+        }
+    }
+
+    // Color Temperature
+    if ((pos = _indexOf(body, "ct")) > 0) {
+        change.colorTemp = _toInt(body, pos + 4);
+        change.fields |= FAUXMO_CHANGE_CT;
+    }
+
+}
+
+void fauxmoESP::_applyChange(uint16_t id, const fauxmoesp_change_t & change) {
+
+    FAUXMO_WRITER_LOCK();
+
+    // Keep the previous state as the starting point of a fade
+    fauxmoesp_state_t from;
+    _readState(id, from);
+
+    // Fields the device type does not have are ignored
+    unsigned char fields = change.fields & _typeFields[_devices[id].type];
+
+    fauxmoesp_state_t device = from;
+    if (FAUXMO_DEVICE_COLOR == _devices[id].type) device.mode = change.mode;
+
+    if (fields & FAUXMO_CHANGE_STATE) {
+        device.state = change.state;
+    }
+
+    if (fields & FAUXMO_CHANGE_VALUE) {
+        device.state = (change.value > 0);
+        device.value = change.value;
+    }
+
+    if (fields & FAUXMO_CHANGE_HUE) {
+        device.state = true;
+        device.hue = change.hue;
+        device.sat = change.sat;
+        // reset color temperature
+        device.colorTemp = 0;
+    }
+
+    if (fields & FAUXMO_CHANGE_XY) {
+        device.state = true;
+        device.x = change.x;
+        device.y = change.y;
+        device.hue = change.hue;
+        device.sat = change.sat;
+        // reset color temperature
+        device.colorTemp = 0;
+    }
+
+    if (fields & FAUXMO_CHANGE_CT) {
+        device.state = true;
+        device.colorTemp = change.colorTemp;
+        // reset hue and saturation
+        device.hue = 0;
+        device.sat = 0;
+    }
+
+    _writeState(id, device);
+    _startFade(id, from, device, change.transition);
+    _stateChanged(id);
+    _markDirty(id, fields);
+
+    FAUXMO_WRITER_UNLOCK();
+
+    // Not logged from _startFade, the serial port cannot be used with the writer lock held
+    if (_fadeCallback) {
+        DEBUG_MSG_FAUXMO("[FAUXMO] Fading device #%d in %lu ms\n", id, (unsigned long) change.transition * 100);
+    }
+
+}
+
+void fauxmoESP::_notifyState(uint16_t id) {
+
+    const char * name = _devices[id].name;
+    fauxmoesp_state_t device;
+    _readState(id, device);
+
+    if (_setStateCallback) {
+        _setStateCallback(id, name, device.state, device.value);
+    }
+    if (_setStateWithColorCallback) {
+        _setStateWithColorCallback(id, name, device.state, device.value, device.hue, device.sat);
+    }
+    if (_setStateWithColorTempCallback) {
+        _setStateWithColorTempCallback(
+            id,
+            name,
+            device.state,
+            device.value,
+            device.hue,
+            device.sat,
+            device.colorTemp
+        );
+    }
+
+}
+
+bool fauxmoESP::_onTCPControl(AsyncClient *client, unsigned char bridge, const char * url, const char * body) {
     // Debug: Print the full body of the incoming message
-    DEBUG_MSG_FAUXMO("[FAUXMO] Received Body:\n%s\n", body.c_str());
+    DEBUG_MSG_FAUXMO("[FAUXMO] Received Body:\n%s\n", body);
 
     // "devicetype" request
-    if (body.indexOf("devicetype") > 0) {
+    if (_indexOf(body, "devicetype") > 0) {
         DEBUG_MSG_FAUXMO("[FAUXMO] Handling devicetype request\n");
         _sendTCPResponse(client, "200 OK", (char *)"[{\"success\":{\"username\": \"2WLEDHardQrI3WHYTHoMcXHgEspsM8ZZRpSKtBQr\"}}]", "application/json");
         return true;
     }
 
     // "state" request
-    if ((url.indexOf("state") > 0) && (body.length() > 0)) {
+    if ((_indexOf(url, "state") > 0) && (body[0] != 0)) {
         // Get the index
-        int pos = url.indexOf("lights");
+        int pos = _indexOf(url, "lights");
         if (pos == -1) return false;
 
         DEBUG_MSG_FAUXMO("[FAUXMO] Handling state request\n");
 
-        // Get the device ID
-        unsigned char id = url.substring(pos + 7).toInt();
-        if (id > 0) {
-            --id;
+        // Get the device ID, local to this bridge
+        uint16_t id = _toInt(url, pos + 7);
+        if ((id > 0) && (id <= _bridgeSize(bridge))) {
 
             // send response fast to prevent timeouts
             char buf[50];
-            snprintf_P(buf, sizeof(buf), PSTR("[{\"success\":{\"/lights/%u/state/\": true}}]"), id+1, _devices[id].state ? "true" : "false");
+            snprintf_P(buf, sizeof(buf), PSTR("[{\"success\":{\"/lights/%u/state/\": true}}]"), id);
             _sendTCPResponse(client, "200 OK", buf, "application/json");
 
-            if (body.indexOf("\"xy\"") > 0) {
-                _devices[id].mode = 'x'; // XY mode
-            } else if (body.indexOf("\"ct\"") > 0) {
-                _devices[id].mode = 'c'; // Color temperature mode
-            } else {
-                _devices[id].mode = 'h'; // Hue/Saturation mode
-            }
+            id = _bridgeFirst(bridge) + id - 1;
 
-            if (body.indexOf("false") > 0) {
-                _devices[id].state = false;
-            } else if (body.indexOf("true") > 0) {
-                _devices[id].state = true;
-            }
+            fauxmoesp_change_t change;
+            _parseChange(body, change);
+            _applyChange(id, change);
+            _notifyState(id);
 
-            // Brightness
-            if ((pos = body.indexOf("bri")) > 0) {
-                unsigned char value = body.substring(pos + 5).toInt();
-                _devices[id].state = (value > 0);
-				if (value == 255) value = 254;
-                _devices[id].value = value;
-            }
+            return true;
+        }
+    }
 
-            // Hue and Saturation
-            if ((pos = body.indexOf("hue")) > 0) {
-                _devices[id].state = true;
-                unsigned int pos_comma = body.indexOf(",", pos);
-                uint16_t hue = body.substring(pos + 5, pos_comma).toInt();
-                pos = body.indexOf("sat", pos_comma);
-                unsigned char sat = body.substring(pos + 5).toInt();
-                _devices[id].hue = hue;
-                _devices[id].sat = sat;
-                // reset color temperature
-                _devices[id].colorTemp = 0;
-            }
+    return false;
+}
 
-            // Color Temperature
-            if ((pos = body.indexOf("ct")) > 0) {
-                _devices[id].state = true;
-                uint16_t ct = body.substring(pos + 4).toInt();
-                _devices[id].colorTemp = ct;
-                // reset hue and saturation
-                _devices[id].hue = 0;
-                _devices[id].sat = 0;
-            }
+bool fauxmoESP::_onTCPGroups(AsyncClient *client, unsigned char bridge, bool isGet, const char * url, const char * body) {
 
+	DEBUG_MSG_FAUXMO("[FAUXMO] Handling group request for: url=%s\n", url);
 
-            // Callbacks
-            if (_setStateCallback) {
-                _setStateCallback(id, _devices[id].name, _devices[id].state, _devices[id].value);
-            }
-            if (_setStateWithColorCallback) {
-                _setStateWithColorCallback(id, _devices[id].name, _devices[id].state, _devices[id].value, _devices[id].hue, _devices[id].sat);
-            }
-            if (_setStateWithColorTempCallback) {
-                _setStateWithColorTempCallback(
-                    id,
-                    _devices[id].name,
-                    _devices[id].state,
-                    _devices[id].value,
-                    _devices[id].hue,
-                    _devices[id].sat,
-                    _devices[id].colorTemp
-                );
-            }
+	int pos = _indexOf(url, "groups");
+	if (-1 == pos) return false;
+	unsigned char id = _toInt(url, pos + 7);
 
-            return true;
-        }
-    }
+	if (isGet) {
+
+		const char * response;
+
+		// Client is requesting all groups, each one is formatted in the arena and then joined.
+		// A bridge only lists the groups with members it hosts
+		if (0 == id) {
+			const char ** groups = (const char **) _arena.alloc(_groups.size() * sizeof(char *));
+			if (!groups) return false;
+			size_t len = 3;
+			for (unsigned char i = 0; i < _groups.size(); i++) {
+				groups[i] = _groupOnBridge(i, bridge) ? _groupJson(i, bridge) : NULL;
+				if (groups[i]) len += strlen(groups[i]) + 8;
+			}
+			char * buffer = (char *) _arena.alloc(len);
+			if (!buffer) return false;
+
+			char * p = buffer;
+			*p++ = '{';
+			for (unsigned char i = 0; i < _groups.size(); i++) {
+				if (!groups[i]) continue;
+				p += sprintf(p, "%s\"%u\":%s", (p > buffer + 1) ? "," : "", i + 1, groups[i]);
+			}
+			*p++ = '}';
+			*p = 0;
+			response = buffer;
+
+		// Client is requesting a single group
+		} else {
+			if ((id > _groups.size()) || !_groupOnBridge(id - 1, bridge)) return false;
+			response = _groupJson(id - 1, bridge);
+		}
+
+		_sendTCPResponse(client, "200 OK", response, "application/json");
+		return true;
+
+	}
+
+	// Group action, one request for all the members this bridge hosts
+	if ((id == 0) || (id > _groups.size()) || !_groupOnBridge(id - 1, bridge)) return false;
+	if ((_indexOf(url, "action") == -1) || (body[0] == 0)) return false;
+	--id;
+
+	// Members of the group in this bridge, the ones the client sees in the group
+	fauxmoesp_group_t & group = _groups[id];
+	uint16_t first = _bridgeFirst(bridge);
+	uint16_t last = first + _bridgeSize(bridge);
+	size_t words = group.members.size();
+	uint32_t * changed = (uint32_t *) _arena.alloc(words * sizeof(uint32_t));
+	if (!changed) return false;
+	memset(changed, 0, words * sizeof(uint32_t));
+
+	char buf[50];
+	snprintf_P(buf, sizeof(buf), PSTR("[{\"success\":{\"/groups/%u/action/\": true}}]"), id + 1);
+	_sendTCPResponse(client, "200 OK", buf, "application/json");
+
+	fauxmoesp_change_t change = {};
+	_parseChange(body, change);
+
+	for (uint16_t i = first; i < last; i++) {
+		if (_bitGet(group.members, i)) {
+			_applyChange(i, change);
+			changed[i >> 5] |= (1UL << (i & 31));
+		}
+	}
+
+	DEBUG_MSG_FAUXMO("[FAUXMO] Group #%d (%s) changed\n", id, group.name);
+
+	// A single notification for the whole group with the change requested, or per device
+	// for applications not using groups
+	if (_setGroupStateCallback) {
+		_setGroupStateCallback(id, group.name, changed, words, change.fields,
+			change.state, change.value, change.hue, change.sat, change.colorTemp);
+	} else {
+		for (uint16_t i = first; i < last; i++) {
+			if (_bitGet(group.members, i)) _notifyState(i);
+		}
+	}
+
+	return true;
 
-    return false;
 }
 
-bool fauxmoESP::_onTCPRequest(AsyncClient *client, bool isGet, String url, String body) {
+bool fauxmoESP::_onTCPRequest(AsyncClient *client, unsigned char bridge, bool isGet, const char * url, const char * body) {
     if (!_enabled) return false;
 
 	#if DEBUG_FAUXMO_VERBOSE_TCP
 		DEBUG_MSG_FAUXMO("[FAUXMO] isGet: %s\n", isGet ? "true" : "false");
-		DEBUG_MSG_FAUXMO("[FAUXMO] URL: %s\n", url.c_str());
-		if (!isGet) DEBUG_MSG_FAUXMO("[FAUXMO] Body:\n%s\n", body.c_str());
+		DEBUG_MSG_FAUXMO("[FAUXMO] URL: %s\n", url);
+		if (!isGet) DEBUG_MSG_FAUXMO("[FAUXMO] Body:\n%s\n", body);
 	#endif
 
-	if (url.equals("/description.xml")) {
-        return _onTCPDescription(client, url, body);
-    }
+	bool handled = false;
 
-	if (url.startsWith("/api")) {
-		if (isGet) {
-			return _onTCPList(client, url, body);
+	if (strcmp(url, "/description.xml") == 0) {
+        handled = _onTCPDescription(client, bridge, url, body);
+    } else if (strncmp(url, "/api", 4) == 0) {
+		if (_indexOf(url, "/groups") > 0) {
+			handled = _onTCPGroups(client, bridge, isGet, url, body);
+		} else if (isGet) {
+			handled = _onTCPList(client, bridge, url, body);
 		} else {
-       		return _onTCPControl(client, url, body);
+       		handled = _onTCPControl(client, bridge, url, body);
 		}
 	}
 
-	return false;
+	// The response has been written, release everything the request allocated
+	_arena.reset();
+
+	return handled;
+
+}
+
+bool fauxmoESP::_onTCPData(AsyncClient *client, unsigned char bridge, unsigned char slot, void *data, size_t len) {
+
+    // The reaper runs in another task on ESP32, it must not delete the client while
+    // the request is being processed. The client may be gone when _processTCPData
+    // returns (it closes it on errors), only the slot is used afterwards
+    FAUXMO_WRITER_LOCK();
+    bool owner = (_tcpClients[slot] == client) && !_tcpExpired[slot];
+    if (owner) _tcpBusy[slot] = true;
+    FAUXMO_WRITER_UNLOCK();
+    if (!owner) return false;
+
+    bool response = _processTCPData(client, bridge, slot, data, len);
+
+    FAUXMO_WRITER_LOCK();
+    _tcpBusy[slot] = false;
+    FAUXMO_WRITER_UNLOCK();
+
+    return response;
 
 }
 
-bool fauxmoESP::_onTCPData(AsyncClient *client, void *data, size_t len) {
+bool fauxmoESP::_processTCPData(AsyncClient *client, unsigned char bridge, unsigned char slot, void *data, size_t len) {
 
     if (!_enabled) return false;
 
+    // Drop requests over the rate of the remote IP before looking at them
+    if (!_tcpBuffers[slot] && !_takeToken(_tcpSources[slot])) {
+        _stats.rateLimited++;
+        DEBUG_MSG_FAUXMO("[FAUXMO] Rejecting - Rate limit on client #%d\n", slot);
+        client->close();
+        return false;
+    }
+
 	char * p = (char *) data;
+
+    // Requests in a single segment are parsed in place, the rest are put together first
+    unsigned char phase = _requestPhase(p, len);
+    if (_tcpBuffers[slot] || (phase != FAUXMO_TCP_PHASE_IDLE)) {
+        if (!_bufferData(slot, p, len)) {
+            _stats.tooLarge++;
+            DEBUG_MSG_FAUXMO("[FAUXMO] Rejecting - Request too large on client #%d\n", slot);
+            _freeBuffer(slot);
+            client->close();
+            return false;
+        }
+        p = _tcpBuffers[slot];
+        len = _tcpLengths[slot];
+        phase = _requestPhase(p, len);
+        if (phase != FAUXMO_TCP_PHASE_IDLE) {
+            // The header deadline is not extended by every segment, only the body gets its own
+            FAUXMO_WRITER_LOCK();
+            if ((_tcpClients[slot] == client) && (phase != _tcpPhases[slot])) {
+                _timerSchedule(slot, phase, (FAUXMO_TCP_PHASE_BODY == phase) ? FAUXMO_TCP_BODY_TIMEOUT : FAUXMO_TCP_HEADER_TIMEOUT);
+            }
+            FAUXMO_WRITER_UNLOCK();
+            return true;
+        }
+    }
+
 	p[len] = 0;
 
 	#if DEBUG_FAUXMO_VERBOSE_TCP
@@ -457,17 +884,15 @@ bool fauxmoESP::_onTCPData(AsyncClient *client, void *data, size_t len) {
 	// Method is the first word of the request
 	char * method = p;
 
-	while (*p != ' ') p++;
-	*p = 0;
-	p++;
+	while ((*p != 0) && (*p != ' ')) p++;
+	if (*p) *p++ = 0;
 	
 	// Split word and flag start of url
 	char * url = p;
 
 	// Find next space
-	while (*p != ' ') p++;
-	*p = 0;
-	p++;
+	while ((*p != 0) && (*p != ' ')) p++;
+	if (*p) *p++ = 0;
 
 	// Find double line feed
 	unsigned char c = 0;
@@ -481,115 +906,453 @@ bool fauxmoESP::_onTCPData(AsyncClient *client, void *data, size_t len) {
 
 	bool isGet = (strncmp(method, "GET", 3) == 0);
 
-	return _onTCPRequest(client, isGet, url, body);
+	bool response = _onTCPRequest(client, bridge, isGet, url, body);
 
-}
+    // Wait for the client to close the connection, or for another request
+    _freeBuffer(slot);
+    FAUXMO_WRITER_LOCK();
+    if (_tcpClients[slot] == client) _timerSchedule(slot, FAUXMO_TCP_PHASE_IDLE, FAUXMO_TCP_IDLE_TIMEOUT);
+    FAUXMO_WRITER_UNLOCK();
 
-void fauxmoESP::_onTCPClient(AsyncClient *client) {
+    return response;
 
-    if (_enabled) {
-        for (unsigned char i = 0; i < FAUXMO_TCP_MAX_CLIENTS; i++) {
-            if (!_tcpClients[i] || !_tcpClients[i]->connected()) {
+}
 
-                // Clean up any previous disconnected client
-                if (_tcpClients[i]) {
-                    delete _tcpClients[i];  // Proper cleanup
-                }
+unsigned char fauxmoESP::_requestPhase(const char * p, size_t len) {
 
-                _tcpClients[i] = client;  // Assign new client
+    // Headers end with an empty line
+    unsigned char c = 0;
+    size_t headers = 0;
+    while ((headers < len) && (c < 2)) {
+        if (p[headers] != '\r') {
+            c = (p[headers] == '\n') ? c + 1 : 0;
+        }
+        headers++;
+    }
+    if (c < 2) return FAUXMO_TCP_PHASE_HEADER;
+
+    // Body length, if any
+    size_t length = 0;
+    for (size_t i = 0; i + 16 <= headers; i++) {
+        if ((p[i] == '\n') && (strncasecmp(p + i + 1, "Content-Length:", 15) == 0)) {
+            length = strtoul(p + i + 16, NULL, 10);
+            break;
+        }
+    }
+    return (len - headers < length) ? FAUXMO_TCP_PHASE_BODY : FAUXMO_TCP_PHASE_IDLE;
 
-                client->onAck([i](void *s, AsyncClient *c, size_t len, uint32_t time) {
-                    // No changes needed here
-                }, 0);
+}
 
-                client->onData([this, i](void *s, AsyncClient *c, void *data, size_t len) {
-                    _onTCPData(c, data, len);
-                }, 0);
+bool fauxmoESP::_bufferData(unsigned char slot, const char * p, size_t len) {
+    size_t total = _tcpLengths[slot] + len;
+    if (total > FAUXMO_TCP_MAX_REQUEST) return false;
+    char * buffer = (char *) realloc(_tcpBuffers[slot], total + 1);
+    if (!buffer) return false;
+    memcpy(buffer + _tcpLengths[slot], p, len);
+    _tcpBuffers[slot] = buffer;
+    _tcpLengths[slot] = total;
+    return true;
+}
 
-                client->onDisconnect([this, i](void *s, AsyncClient *c) {
-                    if (_tcpClients[i]) {
-                        delete _tcpClients[i];  // Proper cleanup
-                        _tcpClients[i] = nullptr;
-                    }
-                    DEBUG_MSG_FAUXMO("[FAUXMO] Client #%d disconnected\n", i);
-                }, 0);
+void fauxmoESP::_freeBuffer(unsigned char slot) {
+    free(_tcpBuffers[slot]);
+    _tcpBuffers[slot] = NULL;
+    _tcpLengths[slot] = 0;
+}
 
-                client->onError([i](void *s, AsyncClient *c, int8_t error) {
-                    DEBUG_MSG_FAUXMO("[FAUXMO] Error %s (%d) on client #%d\n", c->errorToString(error), error, i);
-                }, 0);
+bool fauxmoESP::_isAllowed(uint32_t ip) {
+    if (_allowlist.empty()) return true;
+    return std::find(_allowlist.begin(), _allowlist.end(), ip) != _allowlist.end();
+}
 
-                client->onTimeout([i](void *s, AsyncClient *c, uint32_t time) {
-                    DEBUG_MSG_FAUXMO("[FAUXMO] Timeout on client #%d at %i\n", i, time);
-                    c->close();
-                }, 0);
+int fauxmoESP::_findSource(uint32_t ip) {
 
-                client->setRxTimeout(FAUXMO_RX_TIMEOUT);
+    // Known IP, otherwise claim the least recently used entry without connections
+    int candidate = -1;
+    for (unsigned char i = 0; i < FAUXMO_TCP_SOURCES; i++) {
+        if (_sources[i].used && (_sources[i].ip == ip)) return i;
+        if (_sources[i].connections > 0) continue;
+        if ((candidate < 0) || (_sources[i].last < _sources[candidate].last)) candidate = i;
+    }
+    if (candidate < 0) return -1;
 
-                DEBUG_MSG_FAUXMO("[FAUXMO] Client #%d connected\n", i);
-                return;
-            }
-        }
+    _sources[candidate].used = true;
+    _sources[candidate].ip = ip;
+    _sources[candidate].tokens = _rateBucket();
+    _sources[candidate].last = millis();
+    return candidate;
 
-        DEBUG_MSG_FAUXMO("[FAUXMO] Rejecting - Too many connections\n");
+}
 
-        // If too many clients, close and delete this one immediately
-        client->close();
-        delete client;
+uint32_t fauxmoESP::_rateBucket() {
 
-    } else {
-        DEBUG_MSG_FAUXMO("[FAUXMO] Rejecting - Disabled\n");
+    // An Echo discovering devices reads every light of every bridge, one request each,
+    // so the burst is on top of the device count
+    return (_rateBurst + _devices.size()) * 1000;
 
-        // Cleanup client if Fauxmo is disabled
-        client->close();
-        delete client;
-    }
 }
 
+bool fauxmoESP::_takeToken(unsigned char source) {
 
-// -----------------------------------------------------------------------------
-// Devices
-// -----------------------------------------------------------------------------
+    if (0 == _rate) return true;
 
-fauxmoESP::~fauxmoESP() {
-  	
-	// Free the name for each device
-	for (auto& device : _devices) {
-		free(device.name);
-  	}
-  	
-	// Delete devices  
-	_devices.clear();
+    // Refill _rate requests per second, plus one per device so the Alexa app can poll
+    // every light once a second, up to a full bucket
+    fauxmoesp_source_t & s = _sources[source];
+    uint32_t full = _rateBucket();
+    unsigned long now = millis();
+    unsigned long elapsed = now - s.last;
+    if (elapsed > full) elapsed = full;
+    s.tokens += elapsed * (_rate + _devices.size());
+    if (s.tokens > full) s.tokens = full;
+    s.last = now;
+
+    if (s.tokens < 1000) return false;
+    s.tokens -= 1000;
+    return true;
 
 }
 
-void fauxmoESP::setDeviceUniqueId(unsigned char id, const char *uniqueid)
-{
-    strncpy(_devices[id].uniqueid, uniqueid, FAUXMO_DEVICE_UNIQUE_ID_LENGTH);
+void fauxmoESP::_rejectClient(AsyncClient *client, uint32_t & counter) {
+    counter++;
+    client->close();
+    delete client;
 }
 
-unsigned char fauxmoESP::addDevice(const char * device_name) {
+AsyncClient * fauxmoESP::_detachClient(unsigned char slot) {
+
+    // Called with the writer lock held, whoever detaches the client deletes it
+    _timerCancel(slot);
+    _tcpExpired[slot] = false;
+    AsyncClient * client = _tcpClients[slot];
+    if (client) {
+        _sources[_tcpSources[slot]].connections--;
+        _tcpClients[slot] = nullptr;
+    }
+    return client;
+
+}
+
+void fauxmoESP::_onTCPPoll(AsyncClient *client, unsigned char slot) {
+
+    // Closes the clients the reaper marked as expired, see _handleTimers
+    FAUXMO_WRITER_LOCK();
+    bool expired = (_tcpClients[slot] == client) && _tcpExpired[slot];
+    if (expired) _detachClient(slot);
+    FAUXMO_WRITER_UNLOCK();
+
+    if (expired) {
+        _freeBuffer(slot);
+        client->close(true);
+        delete client;
+    }
+
+}
+
+void fauxmoESP::_onTCPClient(AsyncClient *client, unsigned char bridge) {
+
+    if (!_enabled) {
+        DEBUG_MSG_FAUXMO("[FAUXMO] Rejecting - Disabled\n");
+
+        // Cleanup client if Fauxmo is disabled
+        client->close();
+        delete client;
+        return;
+    }
+
+    // Admission control, nothing is allocated for rejected clients
+    uint32_t ip = client->remoteIP();
+    if (!_isAllowed(ip)) {
+        DEBUG_MSG_FAUXMO("[FAUXMO] Rejecting - %s not allowed\n", client->remoteIP().toString().c_str());
+        _rejectClient(client, _stats.notAllowed);
+        return;
+    }
+
+    FAUXMO_WRITER_LOCK();
+
+    int slot = -1;
+    for (unsigned char i = 0; i < FAUXMO_TCP_MAX_CLIENTS; i++) {
+        if (!_tcpClients[i] || !_tcpClients[i]->connected()) {
+            slot = i;
+            break;
+        }
+    }
+
+    // Clean up any previous disconnected client, so its connection is not counted below
+    AsyncClient * stale = (slot < 0) ? NULL : _detachClient(slot);
+
+    uint32_t * rejected = NULL;
+    int source = (slot < 0) ? -1 : _findSource(ip);
+    if (source < 0) {
+        rejected = &_stats.tooManyClients;
+    } else if ((_maxPerIP > 0) && (_sources[source].connections >= _maxPerIP)) {
+        rejected = &_stats.tooManyPerIP;
+    } else {
+        _tcpClients[slot] = client;  // Assign new client
+        _tcpSources[slot] = source;
+        _sources[source].connections++;
+        _timerSchedule(slot, FAUXMO_TCP_PHASE_HEADER, FAUXMO_TCP_HEADER_TIMEOUT);
+    }
+
+    FAUXMO_WRITER_UNLOCK();
+
+    if (stale) delete stale;
+    if (slot >= 0) _freeBuffer(slot);
+
+    if (rejected) {
+        DEBUG_MSG_FAUXMO("[FAUXMO] Rejecting - Too many connections\n");
+        _rejectClient(client, *rejected);
+        return;
+    }
+
+    unsigned char i = slot;
+
+    client->onAck([i](void *s, AsyncClient *c, size_t len, uint32_t time) {
+        // No changes needed here
+    }, 0);
+
+    client->onData([this, i, bridge](void *s, AsyncClient *c, void *data, size_t len) {
+        _onTCPData(c, bridge, i, data, len);
+    }, 0);
+
+    client->onDisconnect([this, i](void *s, AsyncClient *c) {
+        FAUXMO_WRITER_LOCK();
+        bool owner = (_tcpClients[i] == c);
+        if (owner) _detachClient(i);
+        FAUXMO_WRITER_UNLOCK();
+        if (owner) {
+            _freeBuffer(i);
+            delete c;  // Proper cleanup
+        }
+        DEBUG_MSG_FAUXMO("[FAUXMO] Client #%d disconnected\n", i);
+    }, 0);
+
+    client->onPoll([this, i](void *s, AsyncClient *c) {
+        _onTCPPoll(c, i);
+    }, 0);
+
+    client->onError([i](void *s, AsyncClient *c, int8_t error) {
+        DEBUG_MSG_FAUXMO("[FAUXMO] Error %s (%d) on client #%d\n", c->errorToString(error), error, i);
+    }, 0);
+
+    client->onTimeout([i](void *s, AsyncClient *c, uint32_t time) {
+        DEBUG_MSG_FAUXMO("[FAUXMO] Timeout on client #%d at %i\n", i, time);
+        c->close();
+    }, 0);
+
+    client->setRxTimeout(FAUXMO_RX_TIMEOUT);
+
+    DEBUG_MSG_FAUXMO("[FAUXMO] Client #%d connected to bridge #%d\n", i, bridge);
+
+}
+
+// -----------------------------------------------------------------------------
+// Connection timers
+// -----------------------------------------------------------------------------
+
+void fauxmoESP::_timerLink(unsigned char slot) {
+
+    // Deadlines within FAUXMO_TIMER_SLOTS ticks go to the first level, the rest to the second one
+    uint32_t expire = _timerExpire[slot];
+    unsigned char bucket;
+    if (expire - _timerTick < FAUXMO_TIMER_SLOTS) {
+        bucket = expire & (FAUXMO_TIMER_SLOTS - 1);
+    } else {
+        bucket = FAUXMO_TIMER_SLOTS + ((expire / FAUXMO_TIMER_SLOTS) & (FAUXMO_TIMER_SLOTS - 1));
+    }
+
+    _timerBucket[slot] = bucket + 1;
+    _timerPrev[slot] = 0;
+    _timerNext[slot] = _timerHeads[bucket];
+    if (_timerHeads[bucket]) _timerPrev[_timerHeads[bucket] - 1] = slot + 1;
+    _timerHeads[bucket] = slot + 1;
+
+}
+
+void fauxmoESP::_timerCancel(unsigned char slot) {
+
+    if (0 == _timerBucket[slot]) return;
+
+    unsigned char bucket = _timerBucket[slot] - 1;
+    if (_timerPrev[slot]) {
+        _timerNext[_timerPrev[slot] - 1] = _timerNext[slot];
+    } else {
+        _timerHeads[bucket] = _timerNext[slot];
+    }
+    if (_timerNext[slot]) _timerPrev[_timerNext[slot] - 1] = _timerPrev[slot];
+    _timerBucket[slot] = 0;
+
+}
+
+void fauxmoESP::_timerSchedule(unsigned char slot, unsigned char phase, unsigned long timeout) {
+
+    // Called with the writer lock held. The second level has to stay one bucket
+    // short of a full turn so a deadline never lands in the bucket being expired
+    uint32_t ticks = (timeout + FAUXMO_TIMER_TICK - 1) / FAUXMO_TIMER_TICK;
+    if (ticks < 1) ticks = 1;
+    if (ticks > (FAUXMO_TIMER_SLOTS - 1) * FAUXMO_TIMER_SLOTS) ticks = (FAUXMO_TIMER_SLOTS - 1) * FAUXMO_TIMER_SLOTS;
+
+    _timerCancel(slot);
+    _tcpPhases[slot] = phase;
+    _timerExpire[slot] = _timerTick + ticks;
+    _timerLink(slot);
+
+}
+
+void fauxmoESP::_handleTimers() {
+
+    // Expired clients are only marked here. On ESP32 this runs in the loop task while the
+    // TCP task may be inside a callback of the same client, so they are closed and deleted
+    // from their poll callback, in the TCP task like every other client (_onTCPPoll)
+    #ifdef DEBUG_FAUXMO
+        unsigned char expired[FAUXMO_TCP_MAX_CLIENTS];
+        unsigned char phases[FAUXMO_TCP_MAX_CLIENTS];
+        unsigned char count = 0;
+    #endif
+
+    FAUXMO_WRITER_LOCK();
+
+    while (millis() - _timerLast >= FAUXMO_TIMER_TICK) {
+
+        _timerLast += FAUXMO_TIMER_TICK;
+        _timerTick++;
+
+        // Every FAUXMO_TIMER_SLOTS ticks the next bucket of the second level moves down to the first one
+        if (0 == (_timerTick & (FAUXMO_TIMER_SLOTS - 1))) {
+            unsigned char bucket = FAUXMO_TIMER_SLOTS + ((_timerTick / FAUXMO_TIMER_SLOTS) & (FAUXMO_TIMER_SLOTS - 1));
+            unsigned char next = _timerHeads[bucket];
+            _timerHeads[bucket] = 0;
+            while (next) {
+                unsigned char slot = next - 1;
+                next = _timerNext[slot];
+                _timerLink(slot);
+            }
+        }
+
+        // Everything in the current bucket is due now
+        unsigned char bucket = _timerTick & (FAUXMO_TIMER_SLOTS - 1);
+        while (_timerHeads[bucket]) {
+            unsigned char slot = _timerHeads[bucket] - 1;
+
+            // A request is being processed in the TCP task, look again on the next tick
+            if (_tcpBusy[slot]) {
+                _timerSchedule(slot, _tcpPhases[slot], FAUXMO_TIMER_TICK);
+                continue;
+            }
+
+            if (FAUXMO_TCP_PHASE_HEADER == _tcpPhases[slot]) _stats.headerTimeouts++;
+            if (FAUXMO_TCP_PHASE_BODY == _tcpPhases[slot]) _stats.bodyTimeouts++;
+            if (FAUXMO_TCP_PHASE_IDLE == _tcpPhases[slot]) _stats.idleTimeouts++;
+            _timerCancel(slot);
+            _tcpExpired[slot] = true;
+            #ifdef DEBUG_FAUXMO
+                expired[count] = slot;
+                phases[count++] = _tcpPhases[slot];
+            #endif
+        }
+
+    }
+
+    FAUXMO_WRITER_UNLOCK();
+
+    // Logged out of the lock, the serial port cannot be used inside a critical section
+    #ifdef DEBUG_FAUXMO
+        for (unsigned char i = 0; i < count; i++) {
+            DEBUG_MSG_FAUXMO("[FAUXMO] Client #%d expired in phase %d\n", expired[i], phases[i]);
+        }
+    #endif
+
+}
+
+
+// -----------------------------------------------------------------------------
+// Devices
+// -----------------------------------------------------------------------------
+
+fauxmoESP::~fauxmoESP() {
+
+	// Close the clients still connected and stop the servers
+	for (unsigned char i = 0; i < FAUXMO_TCP_MAX_CLIENTS; i++) {
+		FAUXMO_WRITER_LOCK();
+		AsyncClient * client = _detachClient(i);
+		FAUXMO_WRITER_UNLOCK();
+		if (client) {
+			client->close(true);
+			delete client;
+		}
+		_freeBuffer(i);
+	}
+	for (auto server : _servers) {
+		if (server) delete server;
+	}
+	_servers.clear();
+  	
+	// Free the name for each device
+	for (auto& device : _devices) {
+		free(device.name);
+  	}
+  	
+	// Delete devices  
+	_devices.clear();
+
+	// Same for groups
+	for (auto& group : _groups) {
+		free(group.name);
+	}
+	_groups.clear();
+
+}
+
+void fauxmoESP::setDeviceUniqueId(uint16_t id, const char *uniqueid)
+{
+    strncpy(_devices[id].uniqueid, uniqueid, FAUXMO_DEVICE_UNIQUE_ID_LENGTH);
+}
+
+uint16_t fauxmoESP::addDevice(const char * device_name, fauxmoesp_device_type_t type) {
 
     fauxmoesp_device_t device;
     unsigned int device_id = _devices.size();
 
     // init properties
+    fauxmoesp_state_t state;
+  	state.state = true;
+	  state.value = 100;
+      state.hue = 1;
+      state.sat = 1;
+	  state.colorTemp = 50;
+	  state.x = 20493; // D65 white point (0.3127, 0.3290)
+	  state.y = 21561;
+	  state.mode = 'h'; // possible bvalues 'hs', 'xy', 'ct'
+    if (FAUXMO_DEVICE_CT == type) {
+        state.colorTemp = 370;
+        state.mode = 'c';
+    }
+
     device.name = strdup(device_name);
-  	device.state = true;
-	  device.value = 100;
-      device.hue = 1;
-      device.sat = 1;
-	  device.colorTemp = 50;
-	  device.mode = 'h'; // possible bvalues 'hs', 'xy', 'ct'
+    device.type = type;
+    device.seq = 0;
+    memset(device.data, 0, sizeof(device.data));
+    memcpy(device.data, &state, sizeof(state));
 
     // create the uniqueid
-    String mac = WiFi.macAddress();
-
-    snprintf(device.uniqueid, FAUXMO_DEVICE_UNIQUE_ID_LENGTH, "%02X:%s:%s", device_id, mac.c_str(), "00:00");
+    // ids above 255 use the next to last byte so the first 256 devices keep their original uniqueid
+    snprintf(device.uniqueid, FAUXMO_DEVICE_UNIQUE_ID_LENGTH, "%02X:%s:%02X:00", device_id & 0xFF, _macAddress(), device_id >> 8);
 
 
     // Attach
     _devices.push_back(device);
 
+    // Fades never allocate while holding the writer lock, there is at most one per device
+    _fades.reserve(_devices.size());
+    _frames.reserve(_devices.size());
+    _dirtyFields.push_back(0);
+    _dirtyIds.reserve(_devices.size());
+    _batchMarks.push_back(0);
+    _batch.reserve(_devices.size());
+
+    // Bring up a new bridge if this device does not fit in the current ones
+    if (_enabled) _startServers();
+
     DEBUG_MSG_FAUXMO("[FAUXMO] Device '%s' added as #%d\n", device_name, device_id);
 
     return device_id;
@@ -605,10 +1368,11 @@ int fauxmoESP::getDeviceId(const char * device_name) {
     return -1;
 }
 
-bool fauxmoESP::renameDevice(unsigned char id, const char * device_name) {
+bool fauxmoESP::renameDevice(uint16_t id, const char * device_name) {
     if (id < _devices.size()) {
         free(_devices[id].name);
         _devices[id].name = strdup(device_name);
+        _stateChanged(id);
         DEBUG_MSG_FAUXMO("[FAUXMO] Device #%d renamed to '%s'\n", id, device_name);
         return true;
     }
@@ -621,10 +1385,26 @@ bool fauxmoESP::renameDevice(const char * old_device_name, const char * new_devi
 	return renameDevice(id, new_device_name);
 }
 
-bool fauxmoESP::removeDevice(unsigned char id) {
+bool fauxmoESP::removeDevice(uint16_t id) {
     if (id < _devices.size()) {
         free(_devices[id].name);
 		_devices.erase(_devices.begin()+id);
+        _cancelFade(id);
+        for (auto& fade : _fades) {
+            if (fade.id > id) fade.id--;
+        }
+        for (auto& group : _groups) {
+            _bitErase(group.members, id);
+        }
+        if (_dirtyFields[id]) {
+            _dirtyIds.erase(std::find(_dirtyIds.begin(), _dirtyIds.end(), id));
+        }
+        _dirtyFields.erase(_dirtyFields.begin() + id);
+        _batchMarks.erase(_batchMarks.begin() + id);
+        for (auto& dirty : _dirtyIds) {
+            if (dirty > id) dirty--;
+        }
+        _stateChanged(id);
         DEBUG_MSG_FAUXMO("[FAUXMO] Device #%d removed\n", id);
         return true;
     }
@@ -637,17 +1417,24 @@ bool fauxmoESP::removeDevice(const char * device_name) {
 	return removeDevice(id);
 }
 
-char * fauxmoESP::getDeviceName(unsigned char id, char * device_name, size_t len) {
+char * fauxmoESP::getDeviceName(uint16_t id, char * device_name, size_t len) {
     if ((id < _devices.size()) && (device_name != NULL)) {
         strncpy(device_name, _devices[id].name, len);
     }
     return device_name;
 }
 
-bool fauxmoESP::setState(unsigned char id, bool state, unsigned char value) {
+bool fauxmoESP::setState(uint16_t id, bool state, unsigned char value) {
     if (id < _devices.size()) {
-		_devices[id].state = state;
-		_devices[id].value = value;
+		FAUXMO_WRITER_LOCK();
+		fauxmoesp_state_t current;
+		_readState(id, current);
+		current.state = state;
+		current.value = value;
+		_writeState(id, current);
+		_cancelFade(id);
+		_stateChanged(id);
+		FAUXMO_WRITER_UNLOCK();
 		return true;
 	}
 	return false;
@@ -657,30 +1444,45 @@ bool fauxmoESP::setState(const char * device_name, bool state, unsigned char val
 	return setState(getDeviceId(device_name), state, value);
 }
 
-bool fauxmoESP::setState(unsigned char id, bool state, unsigned char value, uint16_t hue, unsigned char sat) {
+bool fauxmoESP::setState(uint16_t id, bool state, unsigned char value, uint16_t hue, unsigned char sat) {
     if (id < _devices.size()) {
-        _devices[id].state = state;
-        _devices[id].value = value;
-        _devices[id].hue = hue;
-        _devices[id].sat = sat;
+        FAUXMO_WRITER_LOCK();
+        fauxmoesp_state_t current;
+        _readState(id, current);
+        current.state = state;
+        current.value = value;
+        current.hue = hue;
+        current.sat = sat;
+        _writeState(id, current);
+        _cancelFade(id);
+        _stateChanged(id);
+        FAUXMO_WRITER_UNLOCK();
         return true;
     }
+    return false;
 }
 
 bool fauxmoESP::setState(const char * device_name, bool state, unsigned char value, uint16_t hue, unsigned char sat) {
     return setState(getDeviceId(device_name), state, value, hue, sat);
 }
 
-bool fauxmoESP::setState(unsigned char id, bool state, unsigned char value, uint16_t hue, unsigned char sat, uint16_t colorTemp) {
+bool fauxmoESP::setState(uint16_t id, bool state, unsigned char value, uint16_t hue, unsigned char sat, uint16_t colorTemp) {
     if (id >= _devices.size()) return false;
 
     // Update the device state
-    _devices[id].state = state;
+    FAUXMO_WRITER_LOCK();
+    fauxmoesp_state_t current;
+    _readState(id, current);
+    current.state = state;
     if (value == 255) value = 254;
-    _devices[id].value = value;
-    _devices[id].hue = hue;
-    _devices[id].sat = sat;
-    _devices[id].colorTemp = colorTemp; // Set color temperature
+    current.value = value;
+    current.hue = hue;
+    current.sat = sat;
+    current.colorTemp = colorTemp; // Set color temperature
+    _writeState(id, current);
+    _cancelFade(id);
+    _stateChanged(id);
+    FAUXMO_WRITER_UNLOCK();
 
     return true;
 }
@@ -689,16 +1491,547 @@ bool fauxmoESP::setState(const char* device_name, bool state, unsigned char valu
     return setState(getDeviceId(device_name), state, value, hue, sat, colorTemp);
 }
 
+// Sets the fields of an update, color fields also set the color mode of color lights
+static void _updateState(fauxmoesp_state_t & device, const fauxmoesp_update_t & update, bool color) {
+
+    if (update.fields & FAUXMO_CHANGE_STATE) {
+        device.state = update.state;
+    }
+
+    if (update.fields & FAUXMO_CHANGE_VALUE) {
+        device.value = (update.value == 255) ? 254 : update.value;
+    }
+
+    if (update.fields & FAUXMO_CHANGE_HUE) {
+        device.hue = update.hue;
+        device.sat = update.sat;
+        if (color) device.mode = 'h';
+    }
+
+    if (update.fields & FAUXMO_CHANGE_XY) {
+        device.x = update.x;
+        device.y = update.y;
+        if (!(update.fields & FAUXMO_CHANGE_HUE)) {
+            fauxmo_rgb2hs(fauxmo_xy2rgb(update.x, update.y, 254), &device.hue, &device.sat);
+        }
+        if (color) device.mode = 'x';
+    }
+
+    if (update.fields & FAUXMO_CHANGE_CT) {
+        device.colorTemp = update.colorTemp;
+        if (color) device.mode = 'c';
+    }
+
+}
+
+// Adds an entry to the ones of the same device, the result is the same as applying them in order
+static void _mergeUpdate(fauxmoesp_batch_t & batch, const fauxmoesp_update_t & update) {
+
+    fauxmoesp_update_t & merged = batch.update;
+    unsigned char fields = update.fields;
+
+    if (fields & FAUXMO_CHANGE_STATE) merged.state = update.state;
+    if (fields & FAUXMO_CHANGE_VALUE) merged.value = update.value;
+
+    if (fields & FAUXMO_CHANGE_HUE) {
+        merged.hue = update.hue;
+        merged.sat = update.sat;
+        batch.mode = 'h';
+    }
+
+    // XY alone sets hue and saturation from the color, over any earlier hue
+    if (fields & FAUXMO_CHANGE_XY) {
+        merged.x = update.x;
+        merged.y = update.y;
+        if (!(fields & FAUXMO_CHANGE_HUE)) merged.fields &= ~FAUXMO_CHANGE_HUE;
+        batch.mode = 'x';
+    }
+
+    if (fields & FAUXMO_CHANGE_CT) {
+        merged.colorTemp = update.colorTemp;
+        batch.mode = 'c';
+    }
+
+    merged.fields |= fields;
+
+}
+
+size_t fauxmoESP::setStates(fauxmoesp_update_t * updates, size_t count) {
+
+    if (NULL == updates) return 0;
+
+    // Each entry is visited once: names are resolved and the entry is merged with
+    // the previous ones of the same device, found through its mark. The id found
+    // for a name is kept in the entry, so passing the same array again only has
+    // to check it still matches
+    size_t applied = 0;
+    _batch.clear();
+    for (size_t i = 0; i < count; i++) {
+
+        fauxmoesp_update_t & update = updates[i];
+        if (update.name && !((update.id < _devices.size()) && (strcmp(_devices[update.id].name, update.name) == 0))) {
+            int id = getDeviceId(update.name);
+            update.id = (id < 0) ? 0xFFFF : id;
+        }
+        if (update.id >= _devices.size()) continue;
+        applied++;
+
+        uint16_t & mark = _batchMarks[update.id];
+        if (0 == mark) {
+            fauxmoesp_batch_t batch = {};
+            batch.update.id = update.id;
+            _batch.push_back(batch);
+            mark = _batch.size();
+        }
+        _mergeUpdate(_batch[mark - 1], update);
+
+    }
+
+    // One write per device
+    for (auto& batch : _batch) {
+        uint16_t id = batch.update.id;
+        bool color = (FAUXMO_DEVICE_COLOR == _devices[id].type);
+        FAUXMO_WRITER_LOCK();
+        fauxmoesp_state_t current;
+        _readState(id, current);
+        _updateState(current, batch.update, color);
+        if (color && batch.mode) current.mode = batch.mode;
+        _writeState(id, current);
+        _cancelFade(id);
+        FAUXMO_WRITER_UNLOCK();
+        _batchMarks[id] = 0;
+    }
+
+    // One notification for the whole batch
+    if (applied > 0) {
+        FAUXMO_WRITER_LOCK();
+        _stateChanged(0);
+        FAUXMO_WRITER_UNLOCK();
+    }
+
+    DEBUG_MSG_FAUXMO("[FAUXMO] %u of %u updates applied\n", (unsigned int) applied, (unsigned int) count);
+    return applied;
+
+}
+
+bool fauxmoESP::getState(uint16_t id, fauxmoesp_state_t * state) {
+    if ((id >= _devices.size()) || (NULL == state)) return false;
+    _readState(id, *state);
+    return true;
+}
+
+bool fauxmoESP::getState(const char * device_name, fauxmoesp_state_t * state) {
+    return getState(getDeviceId(device_name), state);
+}
+
+size_t fauxmoESP::consumeChanges(fauxmoesp_changed_t * changes, size_t max) {
+
+    // Oldest changes first, whatever does not fit stays for the next call
+    FAUXMO_WRITER_LOCK();
+    size_t count = _dirtyIds.size();
+    if (count > max) count = max;
+    for (size_t i = 0; i < count; i++) {
+        uint16_t id = _dirtyIds[i];
+        changes[i].id = id;
+        changes[i].fields = _dirtyFields[id];
+        _dirtyFields[id] = 0;
+    }
+    _dirtyIds.erase(_dirtyIds.begin(), _dirtyIds.begin() + count);
+    FAUXMO_WRITER_UNLOCK();
+
+    return count;
+
+}
+
+bool fauxmoESP::getDeviceRGB(uint16_t id, uint8_t * rgb, uint8_t channels) {
+
+    if (id >= _devices.size()) return false;
+
+    fauxmoesp_state_t state;
+    _readState(id, state);
+
+    fauxmo_color_t color = {
+        state.mode,
+        state.state ? state.value : (uint8_t) 0,
+        state.hue, state.sat,
+        state.colorTemp,
+        state.x, state.y
+    };
+    fauxmo_color2rgb_n(&color, rgb, 1, channels);
+
+    return true;
+
+}
+
+// -----------------------------------------------------------------------------
+// Groups
+// -----------------------------------------------------------------------------
+
+unsigned char fauxmoESP::addGroup(const char * group_name) {
+
+    fauxmoesp_group_t group;
+    unsigned int group_id = _groups.size();
+    group.name = strdup(group_name);
+    _groups.push_back(group);
+
+    DEBUG_MSG_FAUXMO("[FAUXMO] Group '%s' added as #%d\n", group_name, group_id);
+
+    return group_id;
+
+}
+
+bool fauxmoESP::removeGroup(unsigned char group_id) {
+    if (group_id < _groups.size()) {
+        free(_groups[group_id].name);
+        _groups.erase(_groups.begin() + group_id);
+        DEBUG_MSG_FAUXMO("[FAUXMO] Group #%d removed\n", group_id);
+        return true;
+    }
+    return false;
+}
+
+bool fauxmoESP::addDeviceToGroup(unsigned char group_id, uint16_t device_id) {
+    if ((group_id >= _groups.size()) || (device_id >= _devices.size())) return false;
+    _bitSet(_groups[group_id].members, device_id, true);
+    return true;
+}
+
+bool fauxmoESP::removeDeviceFromGroup(unsigned char group_id, uint16_t device_id) {
+    if (group_id >= _groups.size()) return false;
+    _bitSet(_groups[group_id].members, device_id, false);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+// Fades
+// -----------------------------------------------------------------------------
+
+void fauxmoESP::_fadeFrame(const fauxmoesp_fade_t & fade, unsigned long now, fauxmoesp_frame_t & frame) {
+
+    frame.id = fade.id;
+    frame.mode = fade.mode;
+
+    // Progress in Q15
+    unsigned long elapsed = now - fade.start;
+    int32_t p = (elapsed >= fade.duration) ? 32768 : (int32_t) (((uint64_t) elapsed << 15) / fade.duration);
+
+    frame.value = fade.from_value + ((((int32_t) fade.to_value - fade.from_value) * p) >> 15);
+    frame.hue = fade.from_hue + ((fade.delta_hue * p) >> 15);
+    frame.sat = fade.from_sat + ((((int32_t) fade.to_sat - fade.from_sat) * p) >> 15);
+    frame.colorTemp = fade.from_ct + ((((int32_t) fade.to_ct - fade.from_ct) * p) >> 15);
+
+    // Lights stay on while fading, also when fading out
+    frame.state = (p < 32768) || fade.state;
+
+}
+
+void fauxmoESP::_startFade(uint16_t id, const fauxmoesp_state_t & from, const fauxmoesp_state_t & to, uint16_t transition) {
+
+    if (!_fadeCallback) return;
+
+    // Start from where an ongoing fade is right now, or from the previous state
+    fauxmoesp_frame_t current = { id, from.state, from.value, from.hue, from.sat, from.colorTemp, from.mode };
+    unsigned long now = millis();
+    for (auto& fade : _fades) {
+        if (fade.id == id) _fadeFrame(fade, now, current);
+    }
+    _cancelFade(id);
+
+    // A zero transition still emits one (final) frame so the fade callback sees every change
+    fauxmoesp_fade_t fade;
+    fade.id = id;
+    fade.state = to.state;
+    fade.mode = to.mode;
+    fade.start = now;
+    fade.duration = (unsigned long) transition * 100;
+    fade.from_value = current.state ? current.value : 0;
+    fade.to_value = to.state ? to.value : 0;
+    fade.from_hue = current.hue;
+    fade.delta_hue = (int16_t) (to.hue - current.hue);
+    fade.from_sat = current.sat;
+    fade.to_sat = to.sat;
+    fade.from_ct = current.colorTemp;
+    fade.to_ct = to.colorTemp;
+    _fades.push_back(fade);
+
+}
+
+void fauxmoESP::_cancelFade(uint16_t id) {
+    for (size_t i = 0; i < _fades.size(); i++) {
+        if (_fades[i].id == id) {
+            _fades.erase(_fades.begin() + i);
+            return;
+        }
+    }
+}
+
+void fauxmoESP::_handleFades() {
+
+    if (_fades.empty()) return;
+
+    unsigned long now = millis();
+    if (now - _fadeLast < FAUXMO_FADE_INTERVAL) return;
+    _fadeLast = now;
+
+    // One frame per fading device, finished fades are dropped after their last frame
+    FAUXMO_WRITER_LOCK();
+    _frames.resize(_fades.size());
+    size_t active = 0;
+    for (size_t i = 0; i < _fades.size(); i++) {
+        _fadeFrame(_fades[i], now, _frames[i]);
+        if (now - _fades[i].start < _fades[i].duration) {
+            _fades[active++] = _fades[i];
+        }
+    }
+    _fades.resize(active);
+    FAUXMO_WRITER_UNLOCK();
+
+    if (_fadeCallback) _fadeCallback(_frames.data(), _frames.size());
+
+}
+
+// -----------------------------------------------------------------------------
+// Persistence
+// -----------------------------------------------------------------------------
+
+// Snapshot layout, little endian:
+//   header  "FXMO", version (1), reserved (1), device count (2), CRC32 of the records (4)
+//   record  name hash (4), state (1), value (1), hue (2), sat (1), mode (1), ct (2), x (2), y (2)
+#define FAUXMO_STORAGE_VERSION      1
+#define FAUXMO_STORAGE_HEADER_SIZE  12
+#define FAUXMO_STORAGE_RECORD_SIZE  16
+
+static inline void _put16(uint8_t * p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static inline void _put32(uint8_t * p, uint32_t value) {
+    _put16(p, value);
+    _put16(p + 2, value >> 16);
+}
+
+static inline uint16_t _get16(const uint8_t * p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t _get32(const uint8_t * p) {
+    return _get16(p) | ((uint32_t) _get16(p + 2) << 16);
+}
+
+// FNV-1a, identifies the device a record belongs to
+static uint32_t _hashName(const char * name) {
+    uint32_t hash = 2166136261UL;
+    while (*name) {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+// CRC32 (IEEE 802.3), nibble table
+static uint32_t _crc32(const uint8_t * data, size_t len) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--) {
+        crc = table[(crc ^ *data) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (*data >> 4)) & 0x0F] ^ (crc >> 4);
+        data++;
+    }
+    return ~crc;
+}
+
+void fauxmoESP::_stateChanged(uint16_t id) {
+
+    (void) id;
+
+    // The snapshot is written once the first unsaved change is FAUXMO_STORAGE_DEBOUNCE ms old,
+    // so there is at most one write per period however often the state changes
+    if (_storage && !_storageDirty) {
+        _storageDirty = true;
+        _storageChanged = millis();
+    }
+
+}
+
+void fauxmoESP::_markDirty(uint16_t id, unsigned char fields) {
+
+    // Called with the writer lock held, capacity for every device is reserved in addDevice.
+    // Requests with no field the device supports change nothing, and must not queue the id
+    // again since the list only holds ids with some field set
+    if (0 == fields) return;
+    if (0 == _dirtyFields[id]) _dirtyIds.push_back(id);
+    _dirtyFields[id] |= fields;
+    __atomic_store_n(&_generation, _generation + 1, __ATOMIC_RELEASE);
+
+}
+
+void fauxmoESP::_handleStorage() {
+
+    FAUXMO_WRITER_LOCK();
+    bool due = _storageDirty && (millis() - _storageChanged >= _storageDebounce);
+    if (due) _storageDirty = false;
+    FAUXMO_WRITER_UNLOCK();
+    if (!due) return;
+
+    // Try again in another period if the write fails
+    if (!saveState()) {
+        FAUXMO_WRITER_LOCK();
+        _stateChanged(0);
+        FAUXMO_WRITER_UNLOCK();
+    }
+
+}
+
+bool fauxmoESP::saveState() {
+
+    if (!_storage) return false;
+
+    size_t len = FAUXMO_STORAGE_HEADER_SIZE + _devices.size() * FAUXMO_STORAGE_RECORD_SIZE;
+    uint8_t * buffer = (uint8_t *) malloc(len);
+    if (!buffer) return false;
+
+    uint8_t * p = buffer + FAUXMO_STORAGE_HEADER_SIZE;
+    for (unsigned int id = 0; id < _devices.size(); id++) {
+        fauxmoesp_state_t device;
+        _readState(id, device);
+        _put32(p, _hashName(_devices[id].name));
+        p[4] = device.state ? 1 : 0;
+        p[5] = device.value;
+        _put16(p + 6, device.hue);
+        p[8] = device.sat;
+        p[9] = device.mode;
+        _put16(p + 10, device.colorTemp);
+        _put16(p + 12, device.x);
+        _put16(p + 14, device.y);
+        p += FAUXMO_STORAGE_RECORD_SIZE;
+    }
+
+    uint32_t crc = _crc32(buffer + FAUXMO_STORAGE_HEADER_SIZE, len - FAUXMO_STORAGE_HEADER_SIZE);
+    memcpy(buffer, "FXMO", 4);
+    buffer[4] = FAUXMO_STORAGE_VERSION;
+    buffer[5] = 0;
+    _put16(buffer + 6, _devices.size());
+    _put32(buffer + 8, crc);
+
+    // Do not wear the flash writing the same snapshot again
+    bool success = true;
+    if (crc != _storageCRC) {
+        success = _storage->write(buffer, len);
+        if (success) _storageCRC = crc;
+        DEBUG_MSG_FAUXMO("[FAUXMO] State snapshot (%u bytes) %s\n", (unsigned int) len, success ? "saved" : "failed");
+    }
+
+    free(buffer);
+    return success;
+
+}
+
+bool fauxmoESP::restoreState() {
+
+    if (!_storage) return false;
+
+    size_t len = _storage->size();
+    if (len < FAUXMO_STORAGE_HEADER_SIZE) return false;
+
+    uint8_t * buffer = (uint8_t *) malloc(len);
+    if (!buffer) return false;
+
+    bool valid = (_storage->read(buffer, len) == len)
+        && (memcmp(buffer, "FXMO", 4) == 0)
+        && (buffer[4] == FAUXMO_STORAGE_VERSION)
+        && (len == FAUXMO_STORAGE_HEADER_SIZE + (size_t) _get16(buffer + 6) * FAUXMO_STORAGE_RECORD_SIZE)
+        && (_get32(buffer + 8) == _crc32(buffer + FAUXMO_STORAGE_HEADER_SIZE, len - FAUXMO_STORAGE_HEADER_SIZE));
+
+    if (!valid) {
+        DEBUG_MSG_FAUXMO("[FAUXMO] No valid state snapshot\n");
+        free(buffer);
+        return false;
+    }
+
+    uint16_t count = _get16(buffer + 6);
+    const uint8_t * p = buffer + FAUXMO_STORAGE_HEADER_SIZE;
+    for (uint16_t i = 0; i < count; i++, p += FAUXMO_STORAGE_RECORD_SIZE) {
+
+        // Records are matched by name, devices may have been added or removed since
+        uint32_t hash = _get32(p);
+        int id = -1;
+        if ((i < _devices.size()) && (_hashName(_devices[i].name) == hash)) {
+            id = i;
+        } else {
+            for (unsigned int j = 0; j < _devices.size(); j++) {
+                if (_hashName(_devices[j].name) == hash) {
+                    id = j;
+                    break;
+                }
+            }
+        }
+        if (id < 0) continue;
+
+        fauxmoesp_state_t device;
+        device.state = (p[4] & 0x01);
+        device.value = p[5];
+        device.hue = _get16(p + 6);
+        device.sat = p[8];
+        device.mode = p[9];
+        device.colorTemp = _get16(p + 10);
+        device.x = _get16(p + 12);
+        device.y = _get16(p + 14);
+
+        FAUXMO_WRITER_LOCK();
+        _writeState(id, device);
+        _markDirty(id, _typeFields[_devices[id].type]);
+        FAUXMO_WRITER_UNLOCK();
+        _notifyState(id);
+
+    }
+
+    _storageCRC = _get32(buffer + 8);
+    free(buffer);
+
+    DEBUG_MSG_FAUXMO("[FAUXMO] State restored for %d devices\n", count);
+    return true;
+
+}
+
 // -----------------------------------------------------------------------------
 // Public API
 // -----------------------------------------------------------------------------
 
 bool fauxmoESP::process(AsyncClient *client, bool isGet, String url, String body) {
-	return _onTCPRequest(client, isGet, url, body);
+    return process(client, isGet, url.c_str(), body.c_str());
+}
+
+bool fauxmoESP::process(AsyncClient *client, bool isGet, const char * url, const char * body) {
+
+    if (!url) return false;
+    if (!body) body = "";
+
+    // Same admission rules as the internal servers, the external server owns the connections
+    if (client) {
+        uint32_t ip = client->remoteIP();
+        if (!_isAllowed(ip)) {
+            _stats.notAllowed++;
+            return false;
+        }
+        int source = _findSource(ip);
+        if ((source >= 0) && !_takeToken(source)) {
+            _stats.rateLimited++;
+            return false;
+        }
+    }
+
+	return _onTCPRequest(client, 0, isGet, url, body);
 }
 
 void fauxmoESP::handle() {
     if (_enabled) _handleUDP();
+    _handleTimers();
+    _handleFades();
+    _handleStorage();
 }
 
 void fauxmoESP::enable(bool enable) {
@@ -713,16 +2046,9 @@ void fauxmoESP::enable(bool enable) {
 
     if (_enabled) {
 
-		// Start TCP server if internal
-		if (_internal) {
-			if (NULL == _server) {
-				_server = new AsyncServer(_tcp_port);
-				_server->onClient([this](void *s, AsyncClient* c) {
-					_onTCPClient(c);
-				}, 0);
-			}
-			_server->begin();
-		}
+		// Start a TCP server per bridge (except #0 if using an external server)
+		_startServers();
+		_timerLast = millis();
 
 		// UDP setup
 		#ifdef ESP32
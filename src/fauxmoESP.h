@@ -32,8 +32,23 @@ THE SOFTWARE.
 #define FAUXMO_UDP_MULTICAST_PORT   1900
 #define FAUXMO_TCP_MAX_CLIENTS      10
 #define FAUXMO_TCP_PORT             1901
+#define FAUXMO_MAX_BRIDGES          16      // bridges (and TCP ports) at most, the devices past the limit go to the last one
 #define FAUXMO_RX_TIMEOUT           3
+#define FAUXMO_TCP_MAX_PER_IP       4       // connections from the same remote IP, 0 for no limit
+#define FAUXMO_TCP_RATE             0       // requests per second from the same remote IP, plus one per device, 0 for no limit
+#define FAUXMO_TCP_RATE_BURST       20      // requests allowed in a row before the rate applies, plus one per device
+#define FAUXMO_TCP_SOURCES          FAUXMO_TCP_MAX_CLIENTS  // remote IPs tracked at the same time
+#define FAUXMO_TCP_MAX_REQUEST      1024    // bytes of a request split across several segments
+#define FAUXMO_TCP_HEADER_TIMEOUT   3000    // ms to get the request headers, from the connection or the last response
+#define FAUXMO_TCP_BODY_TIMEOUT     3000    // ms to get the rest of the body once the headers are in
+#define FAUXMO_TCP_IDLE_TIMEOUT     10000   // ms a client may keep the connection open after a response
+#define FAUXMO_TIMER_TICK           100     // ms per tick of the connection timer wheel
+#define FAUXMO_TIMER_SLOTS          32      // buckets per level of the timer wheel, power of 2
 #define FAUXMO_DEVICE_UNIQUE_ID_LENGTH  27
+#define FAUXMO_FADE_INTERVAL        20      // ms between fade frames
+#define FAUXMO_STORAGE_DEBOUNCE     5000    // ms from the first unsaved change to the snapshot write
+#define FAUXMO_ARENA_SIZE           1024    // initial bytes for the transient buffers of a request, grows as needed
+#define FAUXMO_ARENA_MAX_SIZE       4096    // bytes the request arena keeps between requests at most
 
 //#define DEBUG_FAUXMO                Serial
 #ifdef DEBUG_FAUXMO
@@ -71,83 +86,339 @@ THE SOFTWARE.
 #include <WiFiUdp.h>
 #include <functional>
 #include <vector>
-#include <MD5Builder.h>
+#include <algorithm>
 #include "templates.h"
+#include "fauxmoColors.h"
+#include "fauxmoStorage.h"
+#include "fauxmoArena.h"
 
-typedef std::function<void(unsigned char, const char *, bool, unsigned char)> TSetStateCallback;
-typedef std::function<void(unsigned char, const char *, bool, unsigned char, uint16_t, unsigned char)> TSetStateWithColorCallback;
-typedef std::function<void(unsigned char, const char *, bool, unsigned char, uint16_t, unsigned char, uint16_t)> TSetStateWithColorTempCallback;
+typedef std::function<void(uint16_t, const char *, bool, unsigned char)> TSetStateCallback;
+typedef std::function<void(uint16_t, const char *, bool, unsigned char, uint16_t, unsigned char)> TSetStateWithColorCallback;
+typedef std::function<void(uint16_t, const char *, bool, unsigned char, uint16_t, unsigned char, uint16_t)> TSetStateWithColorTempCallback;
 
 typedef struct {
-    char * name;
+    uint16_t id;
     bool state;
     unsigned char value;
     uint16_t hue;
     unsigned char sat;
     uint16_t colorTemp;
-    char uniqueid[FAUXMO_DEVICE_UNIQUE_ID_LENGTH];
     char mode;
+} fauxmoesp_frame_t;
+
+typedef std::function<void(const fauxmoesp_frame_t *, size_t)> TFadeCallback;
+typedef std::function<void(unsigned char, const char *, const uint32_t *, size_t, unsigned char, bool, unsigned char, uint16_t, unsigned char, uint16_t)> TSetGroupStateCallback;
+
+typedef struct {
+    bool state;
+    unsigned char value;
+    unsigned char sat;
+    char mode;                          // 'h' (hue/sat), 'c' (color temperature) or 'x' (xy)
+    uint16_t hue;
+    uint16_t colorTemp;
+    uint16_t x;
+    uint16_t y;
+} fauxmoesp_state_t;
+
+#define FAUXMO_STATE_WORDS          ((sizeof(fauxmoesp_state_t) + 3) / 4)
+
+// Hue light types, from the simplest to the one with every field
+typedef enum {
+    FAUXMO_DEVICE_ONOFF = 0,            // on/off plug
+    FAUXMO_DEVICE_DIMMABLE,             // brightness
+    FAUXMO_DEVICE_CT,                   // brightness and color temperature
+    FAUXMO_DEVICE_COLOR                 // brightness, hue/saturation, xy and color temperature
+} fauxmoesp_device_type_t;
+
+typedef struct {
+    char * name;
+    uint32_t seq;                       // seqlock counter, odd while the state is being written
+    uint32_t data[FAUXMO_STATE_WORDS];  // fauxmoesp_state_t, only accessed through _readState/_writeState
+    char uniqueid[FAUXMO_DEVICE_UNIQUE_ID_LENGTH];
+    unsigned char type;                 // fauxmoesp_device_type_t, fits in the padding after uniqueid
 } fauxmoesp_device_t;
 
+// Writers of the device state (the TCP callbacks and the application) are serialized,
+// readers never block, they retry if a write happened while they were copying
+#if defined(ESP32)
+    #define FAUXMO_WRITER_LOCK()        portENTER_CRITICAL(&_writerMux)
+    #define FAUXMO_WRITER_UNLOCK()      portEXIT_CRITICAL(&_writerMux)
+#elif defined(ARDUINO_RASPBERRY_PI_PICO_W)
+    #define FAUXMO_WRITER_LOCK()        noInterrupts()
+    #define FAUXMO_WRITER_UNLOCK()      interrupts()
+#else
+    // ESP8266 runs the TCP callbacks and the application in the same context
+    #define FAUXMO_WRITER_LOCK()
+    #define FAUXMO_WRITER_UNLOCK()
+#endif
+
+typedef struct {
+    char * name;
+    std::vector<uint32_t> members;      // bitset of device ids
+} fauxmoesp_group_t;
+
+// Admission control bookkeeping for a remote IP
+typedef struct {
+    bool used;
+    uint32_t ip;
+    unsigned char connections;
+    uint32_t tokens;                    // token bucket, in thousandths of a request
+    unsigned long last;                 // last refill
+} fauxmoesp_source_t;
+
+// Rejected connections and requests, by reason
+typedef struct {
+    uint32_t notAllowed;                // remote IP not in the allowlist
+    uint32_t tooManyClients;            // all the client slots busy
+    uint32_t tooManyPerIP;              // FAUXMO_TCP_MAX_PER_IP reached
+    uint32_t rateLimited;               // requests over the rate
+    uint32_t tooLarge;                  // requests over FAUXMO_TCP_MAX_REQUEST
+    uint32_t headerTimeouts;            // connections closed waiting for the headers
+    uint32_t bodyTimeouts;              // connections closed waiting for the body
+    uint32_t idleTimeouts;              // connections left open after the response
+} fauxmoesp_stats_t;
+
+// What a client connection is waiting for
+#define FAUXMO_TCP_PHASE_HEADER     1
+#define FAUXMO_TCP_PHASE_BODY       2
+#define FAUXMO_TCP_PHASE_IDLE       3   // request answered
+
+// Fields present in a state change
+#define FAUXMO_CHANGE_STATE         0x01
+#define FAUXMO_CHANGE_VALUE         0x02
+#define FAUXMO_CHANGE_HUE           0x04    // hue and saturation
+#define FAUXMO_CHANGE_XY            0x08
+#define FAUXMO_CHANGE_CT            0x10
+#define FAUXMO_CHANGE_ALL           0x1F
+
+// Entry of a setStates() batch, only the fields flagged are set
+typedef struct {
+    const char * name;                  // device name, or NULL to use id
+    uint16_t id;                        // filled in for entries by name
+    unsigned char fields;               // FAUXMO_CHANGE_* flags
+    bool state;
+    unsigned char value;
+    uint16_t hue;
+    unsigned char sat;
+    uint16_t x;
+    uint16_t y;
+    uint16_t colorTemp;
+} fauxmoesp_update_t;
+
+// Device changed by a Hue client since the last consumeChanges()
+typedef struct {
+    uint16_t id;
+    unsigned char fields;               // FAUXMO_CHANGE_* flags
+} fauxmoesp_changed_t;
+
+typedef struct {
+    unsigned char fields;
+    char mode;
+    bool state;
+    unsigned char value;
+    uint16_t hue;
+    unsigned char sat;
+    uint16_t x;
+    uint16_t y;
+    uint16_t colorTemp;
+    uint16_t transition;
+} fauxmoesp_change_t;
+
+typedef struct {
+    uint16_t id;
+    bool state;
+    char mode;
+    unsigned long start;
+    unsigned long duration;
+    unsigned char from_value, to_value;
+    uint16_t from_hue;
+    int32_t delta_hue;                  // shortest way around the circle
+    unsigned char from_sat, to_sat;
+    uint16_t from_ct, to_ct;
+} fauxmoesp_fade_t;
+
+// Entries of a device in a setStates() batch, merged in order
+typedef struct {
+    fauxmoesp_update_t update;
+    char mode;                          // color mode of the last color field, 0 if none
+} fauxmoesp_batch_t;
+
 class fauxmoESP {
 
     public:
 
         ~fauxmoESP();
 
-        unsigned char addDevice(const char * device_name);
-        bool renameDevice(unsigned char id, const char * device_name);
+        uint16_t addDevice(const char * device_name, fauxmoesp_device_type_t type = FAUXMO_DEVICE_COLOR);
+        bool renameDevice(uint16_t id, const char * device_name);
         bool renameDevice(const char * old_device_name, const char * new_device_name);
-        bool removeDevice(unsigned char id);
+        bool removeDevice(uint16_t id);
         bool removeDevice(const char * device_name);
-        char * getDeviceName(unsigned char id, char * buffer, size_t len);
+        char * getDeviceName(uint16_t id, char * buffer, size_t len);
         int getDeviceId(const char * device_name);
-        void setDeviceUniqueId(unsigned char id, const char *uniqueid);
+        void setDeviceUniqueId(uint16_t id, const char *uniqueid);
         void onSetState(TSetStateCallback fn) { _setStateCallback = fn; }
         void onSetState(TSetStateWithColorCallback fn) { _setStateWithColorCallback = fn; }
         void onSetState(TSetStateWithColorTempCallback fn) { _setStateWithColorTempCallback = fn; }
-        bool setState(unsigned char id, bool state, unsigned char value);
+        bool setState(uint16_t id, bool state, unsigned char value);
         bool setState(const char * device_name, bool state, unsigned char value);
-        bool setState(unsigned char id, bool state, unsigned char value, uint16_t hue, unsigned char sat);
+        bool setState(uint16_t id, bool state, unsigned char value, uint16_t hue, unsigned char sat);
         bool setState(const char * device_name, bool state, unsigned char value, uint16_t hue, unsigned char sat);
-        bool setState(unsigned char id, bool state, unsigned char value, uint16_t hue, unsigned char sat, uint16_t colorTemp);
+        bool setState(uint16_t id, bool state, unsigned char value, uint16_t hue, unsigned char sat, uint16_t colorTemp);
         bool setState(const char* device_name, bool state, unsigned char value, uint16_t hue, unsigned char sat, uint16_t colorTemp);
+        size_t setStates(fauxmoesp_update_t * updates, size_t count);
+        unsigned char addGroup(const char * group_name);
+        bool removeGroup(unsigned char group_id);
+        bool addDeviceToGroup(unsigned char group_id, uint16_t device_id);
+        bool removeDeviceFromGroup(unsigned char group_id, uint16_t device_id);
+        void onSetGroupState(TSetGroupStateCallback fn) { _setGroupStateCallback = fn; }
+        void onFade(TFadeCallback fn) { _fadeCallback = fn; }
+        void setDefaultTransition(uint16_t transition) { _defaultTransition = transition; }
+        bool isFading() { return !_fades.empty(); }
+        void setStorage(fauxmoStorage * storage, unsigned long debounce = FAUXMO_STORAGE_DEBOUNCE) { _storage = storage; _storageDebounce = debounce; }
+        bool restoreState();
+        bool saveState();
+        bool getState(uint16_t id, fauxmoesp_state_t * state);
+        bool getState(const char * device_name, fauxmoesp_state_t * state);
+        bool getDeviceRGB(uint16_t id, uint8_t * rgb, uint8_t channels = 3);
+        size_t consumeChanges(fauxmoesp_changed_t * changes, size_t max);
+        uint32_t getGeneration() { return __atomic_load_n(&_generation, __ATOMIC_ACQUIRE); }
         bool process(AsyncClient *client, bool isGet, String url, String body);
+        bool process(AsyncClient *client, bool isGet, const char * url, const char * body);
         void enable(bool enable);
         void createServer(bool internal) { _internal = internal; }
         void setPort(unsigned long tcp_port) { _tcp_port = tcp_port; }
+        void setMaxDevicesPerBridge(uint16_t count) { _devicesPerBridge = count; }
+        unsigned char getBridgeCount() { return _bridgeCount(); }
+        void setMaxClientsPerIP(unsigned char count) { _maxPerIP = count; }
+        void setRateLimit(unsigned int rate, unsigned int burst = FAUXMO_TCP_RATE_BURST) { _rate = rate; _rateBurst = burst; }
+        void addAllowedIP(IPAddress ip) { _allowlist.push_back((uint32_t) ip); }
+        void clearAllowedIPs() { _allowlist.clear(); }
+        fauxmoesp_stats_t getStats() { return _stats; }
+        void resetStats() { memset(&_stats, 0, sizeof(_stats)); }
         void handle();
 
     private:
 
-        AsyncServer * _server;
+        std::vector<AsyncServer *> _servers;   // one per bridge, #0 is NULL when using an external server
         bool _enabled = false;
         bool _internal = true;
         unsigned int _tcp_port = FAUXMO_TCP_PORT;
+        uint16_t _devicesPerBridge = 0;          // 0 means a single bridge for all devices
         std::vector<fauxmoesp_device_t> _devices;
+        std::vector<fauxmoesp_group_t> _groups;
+		#ifdef ESP32
+        portMUX_TYPE _writerMux = portMUX_INITIALIZER_UNLOCKED;
+		#endif
 		#ifdef ESP8266
         WiFiEventHandler _handler;
 		#endif
         WiFiUDP _udp;
-        AsyncClient * _tcpClients[FAUXMO_TCP_MAX_CLIENTS];
+        AsyncClient * _tcpClients[FAUXMO_TCP_MAX_CLIENTS] = {};
+        unsigned char _tcpSources[FAUXMO_TCP_MAX_CLIENTS] = {};     // index in _sources of each client
+        unsigned char _tcpPhases[FAUXMO_TCP_MAX_CLIENTS] = {};
+        bool _tcpBusy[FAUXMO_TCP_MAX_CLIENTS] = {};                 // onData running, the reaper leaves it alone
+        bool _tcpExpired[FAUXMO_TCP_MAX_CLIENTS] = {};              // marked by the reaper, closed from the TCP task
+        char * _tcpBuffers[FAUXMO_TCP_MAX_CLIENTS] = {};            // requests split across segments
+        size_t _tcpLengths[FAUXMO_TCP_MAX_CLIENTS] = {};
+        fauxmoesp_source_t _sources[FAUXMO_TCP_SOURCES] = {};
+        std::vector<uint32_t> _allowlist;    // empty to accept any remote IP
+        unsigned char _maxPerIP = FAUXMO_TCP_MAX_PER_IP;
+        unsigned int _rate = FAUXMO_TCP_RATE;
+        unsigned int _rateBurst = FAUXMO_TCP_RATE_BURST;
+        fauxmoesp_stats_t _stats = {};
+        fauxmoArena _arena{FAUXMO_ARENA_SIZE, FAUXMO_ARENA_MAX_SIZE};    // requests are handled one at a time, in the TCP task
+        char _mac[18] = {};
+
+        // Hierarchical timer wheel with the deadline of each client slot: FAUXMO_TIMER_SLOTS buckets
+        // of one tick, then FAUXMO_TIMER_SLOTS buckets of FAUXMO_TIMER_SLOTS ticks. Links are slot + 1, 0 is none
+        unsigned char _timerHeads[2 * FAUXMO_TIMER_SLOTS] = {};
+        unsigned char _timerNext[FAUXMO_TCP_MAX_CLIENTS] = {};
+        unsigned char _timerPrev[FAUXMO_TCP_MAX_CLIENTS] = {};
+        unsigned char _timerBucket[FAUXMO_TCP_MAX_CLIENTS] = {};   // bucket + 1, 0 when not scheduled
+        uint32_t _timerExpire[FAUXMO_TCP_MAX_CLIENTS] = {};         // in ticks
+        uint32_t _timerTick = 0;
+        unsigned long _timerLast = 0;
         TSetStateCallback _setStateCallback = NULL;
         TSetStateWithColorCallback _setStateWithColorCallback = NULL;
         TSetStateWithColorTempCallback _setStateWithColorTempCallback = NULL;
+        TSetGroupStateCallback _setGroupStateCallback = NULL;
+        TFadeCallback _fadeCallback = NULL;
+        uint16_t _defaultTransition = 0;    // in 100ms steps, like the Hue API
+        std::vector<fauxmoesp_fade_t> _fades;
+        std::vector<fauxmoesp_frame_t> _frames;
+        unsigned long _fadeLast = 0;
+        fauxmoStorage * _storage = NULL;
+        unsigned long _storageDebounce = FAUXMO_STORAGE_DEBOUNCE;
+        unsigned long _storageChanged = 0;
+        bool _storageDirty = false;
+        uint32_t _storageCRC = 0;           // of the last snapshot written or restored
+        uint32_t _generation = 0;           // bumped on every change made by a Hue client
+        std::vector<unsigned char> _dirtyFields;    // per device, FAUXMO_CHANGE_* flags not consumed yet
+        std::vector<uint16_t> _dirtyIds;            // devices with dirty fields, in order of change
+        std::vector<uint16_t> _batchMarks;          // per device, index + 1 in _batch during setStates()
+        std::vector<fauxmoesp_batch_t> _batch;      // devices in the current setStates() batch, in order
 
-        String _deviceJson(unsigned char id, bool all); 	// all = true means we are listing all devices so use full description template
+        static const char * const _typeNames[];
+        static const unsigned char _typeFields[];
+
+        int _deviceJsonFormat(char * buffer, size_t size, uint16_t id, const fauxmoesp_state_t & device, bool all);
+        char * _deviceJson(uint16_t id, bool all); 	// all = true means we are listing all devices so use full description template
+        char * _groupJson(unsigned char id, unsigned char bridge);
+
+        unsigned char _bridgeLimit();
+        unsigned char _bridgeCount();
+        uint16_t _bridgeFirst(unsigned char bridge);
+        uint16_t _bridgeSize(unsigned char bridge);
+        bool _groupOnBridge(unsigned char group, unsigned char bridge);
+        const char * _macAddress();
+        void _bridgeId(unsigned char bridge, char * buffer);
+        void _startServers();
 
         void _handleUDP();
         void _onUDPData(const IPAddress remoteIP, unsigned int remotePort, void *data, size_t len);
-        void _sendUDPResponse();
-
-        void _onTCPClient(AsyncClient *client);
-        bool _onTCPData(AsyncClient *client, void *data, size_t len);
-        bool _onTCPRequest(AsyncClient *client, bool isGet, String url, String body);
-        bool _onTCPDescription(AsyncClient *client, String url, String body);
-        bool _onTCPList(AsyncClient *client, String url, String body);
-        bool _onTCPControl(AsyncClient *client, String url, String body);
-        void _sendTCPResponse(AsyncClient *client, const char * code, char * body, const char * mime);
-
-        String _byte2hex(uint8_t zahl);
-        String _makeMD5(String text);
+        void _sendUDPResponse(unsigned char bridge);
+
+        bool _isAllowed(uint32_t ip);
+        int _findSource(uint32_t ip);
+        uint32_t _rateBucket();
+        bool _takeToken(unsigned char source);
+        void _rejectClient(AsyncClient *client, uint32_t & counter);
+        AsyncClient * _detachClient(unsigned char slot);
+        unsigned char _requestPhase(const char * p, size_t len);
+        bool _bufferData(unsigned char slot, const char * p, size_t len);
+        void _freeBuffer(unsigned char slot);
+        void _onTCPClient(AsyncClient *client, unsigned char bridge);
+        void _onTCPPoll(AsyncClient *client, unsigned char slot);
+        bool _onTCPData(AsyncClient *client, unsigned char bridge, unsigned char slot, void *data, size_t len);
+        bool _processTCPData(AsyncClient *client, unsigned char bridge, unsigned char slot, void *data, size_t len);
+        bool _onTCPRequest(AsyncClient *client, unsigned char bridge, bool isGet, const char * url, const char * body);
+        bool _onTCPDescription(AsyncClient *client, unsigned char bridge, const char * url, const char * body);
+        bool _onTCPList(AsyncClient *client, unsigned char bridge, const char * url, const char * body);
+        bool _onTCPControl(AsyncClient *client, unsigned char bridge, const char * url, const char * body);
+        bool _onTCPGroups(AsyncClient *client, unsigned char bridge, bool isGet, const char * url, const char * body);
+        void _sendTCPResponse(AsyncClient *client, const char * code, const char * body, const char * mime);
+
+        uint16_t _parseUnit(const char * p);
+        static int _indexOf(const char * haystack, const char * needle, int from = 0);
+        static int _toInt(const char * text, int from);
+        void _parseChange(const char * body, fauxmoesp_change_t & change);
+        void _readState(uint16_t id, fauxmoesp_state_t & state);
+        void _writeState(uint16_t id, const fauxmoesp_state_t & state);
+        void _applyChange(uint16_t id, const fauxmoesp_change_t & change);
+        void _notifyState(uint16_t id);
+        void _stateChanged(uint16_t id);
+        void _markDirty(uint16_t id, unsigned char fields);
+        void _handleStorage();
+
+        void _startFade(uint16_t id, const fauxmoesp_state_t & from, const fauxmoesp_state_t & to, uint16_t transition);
+        void _fadeFrame(const fauxmoesp_fade_t & fade, unsigned long now, fauxmoesp_frame_t & frame);
+        void _cancelFade(uint16_t id);
+        void _handleFades();
+
+        void _timerLink(unsigned char slot);
+        void _timerCancel(unsigned char slot);
+        void _timerSchedule(unsigned char slot, unsigned char phase, unsigned long timeout);
+        void _handleTimers();
+
 };
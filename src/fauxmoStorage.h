@@ -0,0 +1,128 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Backend for the device state snapshot. The snapshot is always read and
+// written as a whole, so a backend only has to store one blob.
+class fauxmoStorage {
+
+    public:
+
+        virtual ~fauxmoStorage() {}
+
+        virtual size_t size() = 0;                                  // 0 if there is no snapshot
+        virtual size_t read(uint8_t * buffer, size_t len) = 0;      // returns the bytes read
+        virtual bool write(const uint8_t * buffer, size_t len) = 0;
+
+};
+
+// Snapshot in a file, using the C standard library (Linux, ESP32 VFS)
+class fauxmoFileStorage : public fauxmoStorage {
+
+    public:
+
+        fauxmoFileStorage(const char * path) : _path(path) {}
+
+        size_t size() {
+            FILE * f = fopen(_path, "rb");
+            if (!f) return 0;
+            fseek(f, 0, SEEK_END);
+            long len = ftell(f);
+            fclose(f);
+            return (len > 0) ? len : 0;
+        }
+
+        size_t read(uint8_t * buffer, size_t len) {
+            FILE * f = fopen(_path, "rb");
+            if (!f) return 0;
+            size_t n = fread(buffer, 1, len, f);
+            fclose(f);
+            return n;
+        }
+
+        bool write(const uint8_t * buffer, size_t len) {
+            FILE * f = fopen(_path, "wb");
+            if (!f) return false;
+            size_t n = fwrite(buffer, 1, len, f);
+            return (fclose(f) == 0) && (n == len);
+        }
+
+    private:
+
+        const char * _path;
+
+};
+
+#if __has_include(<FS.h>)
+
+#include <FS.h>
+
+// Snapshot in a file of an Arduino filesystem (LittleFS, SPIFFS, SD...)
+class fauxmoFSStorage : public fauxmoStorage {
+
+    public:
+
+        fauxmoFSStorage(fs::FS & fs, const char * path) : _fs(fs), _path(path) {}
+
+        size_t size() {
+            File f = _fs.open(_path, "r");
+            if (!f) return 0;
+            size_t len = f.size();
+            f.close();
+            return len;
+        }
+
+        size_t read(uint8_t * buffer, size_t len) {
+            File f = _fs.open(_path, "r");
+            if (!f) return 0;
+            size_t n = f.read(buffer, len);
+            f.close();
+            return n;
+        }
+
+        bool write(const uint8_t * buffer, size_t len) {
+            File f = _fs.open(_path, "w");
+            if (!f) return false;
+            size_t n = f.write(buffer, len);
+            f.close();
+            return n == len;
+        }
+
+    private:
+
+        fs::FS & _fs;
+        const char * _path;
+
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <ESPAsyncWebServer.h>
+#include "fauxmoESP.h"
+
+// Hands the Hue requests received by an ESPAsyncWebServer to fauxmoESP, for the
+// external server mode (createServer(false)):
+//
+//     server.addHandler(new fauxmoWebHandler(fauxmo));
+//
+// Body chunks are put together in a buffer owned by the request (up to
+// FAUXMO_TCP_MAX_REQUEST bytes), so fauxmoESP gets every request once and
+// complete, as plain C strings.
+class fauxmoWebHandler : public AsyncWebHandler {
+
+    public:
+
+        fauxmoWebHandler(fauxmoESP & fauxmo) : _fauxmo(fauxmo) {}
+
+        // Newer versions of the server declare these const, define both so either one is overridden
+        bool canHandle(AsyncWebServerRequest * request) { return _canHandle(request); }
+        bool canHandle(AsyncWebServerRequest * request) const { return _canHandle(request); }
+        bool isRequestHandlerTrivial() { return false; }
+        bool isRequestHandlerTrivial() const { return false; }
+
+        void handleBody(AsyncWebServerRequest * request, uint8_t * data, size_t len, size_t index, size_t total) {
+
+            // Too large requests get no buffer and are rejected in handleRequest
+            if ((total > FAUXMO_TCP_MAX_REQUEST) || (index + len > total)) return;
+
+            if (0 == index) {
+                free(request->_tempObject);
+                request->_tempObject = malloc(total + 1);
+            }
+            char * buffer = (char *) request->_tempObject;
+            if (!buffer) return;
+
+            memcpy(buffer + index, data, len);
+            buffer[index + len] = 0;
+
+        }
+
+        void handleRequest(AsyncWebServerRequest * request) {
+
+            // Bodies the server recognized as a form come as the "body" parameter instead of chunks
+            const char * body = (const char *) request->_tempObject;
+            if (!body && request->hasParam("body", true)) {
+                body = request->getParam("body", true)->value().c_str();
+            }
+            if (!body && (request->contentLength() > 0)) {
+                request->send(413);
+                return;
+            }
+
+            // fauxmoESP writes the response to the client itself
+            if (!_fauxmo.process(request->client(), request->method() == HTTP_GET, request->url().c_str(), body ? body : "")) {
+                request->send(404);
+            }
+
+        }
+
+    private:
+
+        fauxmoESP & _fauxmo;
+
+        bool _canHandle(AsyncWebServerRequest * request) const {
+            const char * url = request->url().c_str();
+            return (strcmp(url, "/description.xml") == 0) || (strncmp(url, "/api", 4) == 0);
+        }
+
+};
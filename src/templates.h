@@ -76,6 +76,7 @@ PROGMEM const char FAUXMO_DEVICE_JSON_TEMPLATE[] = "{"
         "\"hue\": %d,"
         "\"sat\": %d,"
         "\"ct\": %d,"
+        "\"xy\": [%d.%04d,%d.%04d],"
 	    "\"colormode\": \"%s\"," // hs, ct, xy
         "\"effect\": \"none\","
         "\"mode\": \"homeautomation\","
@@ -88,14 +89,80 @@ PROGMEM const char FAUXMO_DEVICE_JSON_TEMPLATE[] = "{"
     "\"swversion\": \"1.53.3_r27175\""
 "}";
 
-// Use shorter description template when listing all devices
+// Dimmable light, on/off and brightness only
+PROGMEM const char FAUXMO_DIMMABLE_JSON_TEMPLATE[] = "{"
+    "\"type\": \"Dimmable light\","
+    "\"name\": \"%s\","
+    "\"uniqueid\": \"%s\","
+    "\"modelid\": \"LWB010\","
+    "\"manufacturername\": \"Philips\","
+    "\"productname\": \"Hue white lamp\","
+    "\"state\":{"
+        "\"on\": %s,"
+        "\"bri\": %d,"
+        "\"mode\": \"homeautomation\","
+        "\"reachable\": true"
+    "},"
+    "\"swversion\": \"1.53.3_r27175\""
+"}";
+
+// White ambiance light, brightness and color temperature
+PROGMEM const char FAUXMO_CT_JSON_TEMPLATE[] = "{"
+    "\"type\": \"Color temperature light\","
+    "\"name\": \"%s\","
+    "\"uniqueid\": \"%s\","
+    "\"modelid\": \"LTW001\","
+    "\"manufacturername\": \"Philips\","
+    "\"productname\": \"Hue ambiance lamp\","
+    "\"state\":{"
+        "\"on\": %s,"
+        "\"bri\": %d,"
+        "\"ct\": %d,"
+        "\"colormode\": \"ct\","
+        "\"mode\": \"homeautomation\","
+        "\"reachable\": true"
+    "},"
+    "\"swversion\": \"1.53.3_r27175\""
+"}";
+
+// Smart plug, on/off only
+PROGMEM const char FAUXMO_ONOFF_JSON_TEMPLATE[] = "{"
+    "\"type\": \"On/Off plug-in unit\","
+    "\"name\": \"%s\","
+    "\"uniqueid\": \"%s\","
+    "\"modelid\": \"LOM001\","
+    "\"manufacturername\": \"Philips\","
+    "\"productname\": \"Hue Smart plug\","
+    "\"state\":{"
+        "\"on\": %s,"
+        "\"mode\": \"homeautomation\","
+        "\"reachable\": true"
+    "},"
+    "\"swversion\": \"1.53.3_r27175\""
+"}";
+
+// Use shorter description template when listing all devices, the type is one of the above
 PROGMEM const char FAUXMO_DEVICE_JSON_TEMPLATE_SHORT[] = "{"
-    "\"type\": \"Extended color light\","
+    "\"type\": \"%s\","
     "\"name\": \"%s\","
     "\"uniqueid\": \"%s\""
 
 "}";
 
+PROGMEM const char FAUXMO_GROUP_JSON_TEMPLATE[] = "{"
+    "\"name\": \"%s\","
+    "\"lights\": [%s],"
+    "\"type\": \"LightGroup\","
+    "\"action\":{"
+        "\"on\": %s,"
+        "\"bri\": %d"
+    "},"
+    "\"state\":{"
+        "\"all_on\": %s,"
+        "\"any_on\": %s"
+    "}"
+"}";
+
 
 PROGMEM const char FAUXMO_DESCRIPTION_TEMPLATE[] =
 "<?xml version=\"1.0\" ?>"
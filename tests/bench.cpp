@@ -0,0 +1,269 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// Benchmarks for the request paths, from the packet or segment to the
+// response, at 1, 16, 64 and 255 devices. Reports the time, the heap
+// allocations and the peak heap above the idle state per request.
+//
+// The "connect" row is a request to an unknown URL: the cost of the
+// AsyncClient stand-in (accept, copy of the segment, close), to subtract
+// from the rest when comparing with a device.
+//
+// The last two rows are application updates of 20 devices by name, one
+// setState call each or one setStates batch (times are for the 20).
+//
+// A second table times the color conversions (fauxmoColors.h) per pixel,
+// one call per pixel and the batch versions over a 256 pixel buffer.
+//
+// Usage: bench [iterations]        (default 2000 per row)
+
+#include "test.h"
+#include "heap.h"
+#include "fauxmoColors.h"
+#include <chrono>
+
+typedef struct {
+    const char * name;
+    std::string request;        // empty for SSDP
+} scenario_t;
+
+static void _run(fauxmoESP & fauxmo, const scenario_t & scenario, int devices, int iterations) {
+
+    WiFiUDP * udp = WiFiUDP::find(FAUXMO_UDP_MULTICAST_PORT);
+    udp->sent.reserve(1);
+    size_t bytes = 0;
+
+    // Warm up, and check it works
+    for (int i = 0; i < 10; i++) {
+        if (scenario.request.empty()) {
+            udp->inject(HOST_SSDP_SEARCH, strlen(HOST_SSDP_SEARCH));
+            fauxmo.handle();
+            bytes = udp->sent.empty() ? 0 : udp->sent[0].data.size();
+            udp->sent.clear();
+        } else {
+            bytes = hostRequest(FAUXMO_TCP_PORT, scenario.request).size();
+        }
+    }
+
+    heapReset();
+    host_heap_t before = heapStats();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++) {
+        if (scenario.request.empty()) {
+            udp->inject(HOST_SSDP_SEARCH, strlen(HOST_SSDP_SEARCH));
+            fauxmo.handle();
+            udp->sent.clear();
+        } else {
+            hostRequest(FAUXMO_TCP_PORT, scenario.request);
+        }
+    }
+
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    host_heap_t after = heapStats();
+
+    printf("%-12s %7d %12.0f %14.1f %12zu %10zu\n",
+        scenario.name, devices, elapsed / iterations,
+        (double) (after.allocs - before.allocs) / iterations,
+        after.peak - before.current, bytes);
+
+}
+
+// 20 devices by name, spread over the list, with setState or with one setStates
+static void _runUpdates(fauxmoESP & fauxmo, int devices, int iterations, bool batch) {
+
+    char names[20][32];
+    fauxmoesp_update_t updates[20] = {};
+    for (int i = 0; i < 20; i++) {
+        snprintf(names[i], sizeof(names[i]), "light %d", (i * devices / 20) % devices);
+        updates[i].name = names[i];
+        updates[i].fields = FAUXMO_CHANGE_STATE | FAUXMO_CHANGE_VALUE;
+        updates[i].state = true;
+    }
+
+    heapReset();
+    host_heap_t before = heapStats();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int n = 0; n < iterations; n++) {
+        if (batch) {
+            for (int i = 0; i < 20; i++) updates[i].value = n & 0xFF;
+            fauxmo.setStates(updates, 20);
+        } else {
+            for (int i = 0; i < 20; i++) fauxmo.setState(names[i], true, n & 0xFF);
+        }
+    }
+
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    host_heap_t after = heapStats();
+
+    printf("%-12s %7d %12.0f %14.1f %12zu %10s\n",
+        batch ? "setStates" : "setState", devices, elapsed / iterations,
+        (double) (after.allocs - before.allocs) / iterations,
+        after.peak - before.current, "-");
+
+}
+
+// Color conversions, over inputs spread across the whole range
+#define BENCH_PIXELS    256
+
+static volatile uint32_t _sink;
+
+typedef struct {
+    uint16_t hue[BENCH_PIXELS];
+    uint8_t sat[BENCH_PIXELS];
+    uint8_t bri[BENCH_PIXELS];
+    uint16_t ct[BENCH_PIXELS];
+    uint16_t x[BENCH_PIXELS];
+    uint16_t y[BENCH_PIXELS];
+    fauxmo_rgb_t rgb[BENCH_PIXELS];
+    fauxmo_color_t colors[BENCH_PIXELS];
+    uint8_t out[BENCH_PIXELS * 4];
+} color_inputs_t;
+
+static void _colorRow(const char * name, int iterations, const std::function<uint32_t()> & pass) {
+    uint32_t sum = pass();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++) sum += pass();
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    _sink = sum;
+    printf("%-16s %12.2f %14.1f\n", name, elapsed / iterations / BENCH_PIXELS, 1e3 * iterations * BENCH_PIXELS / elapsed);
+}
+
+static void _runColors(int iterations) {
+
+    static color_inputs_t in;
+    const char modes[] = { 'h', 'c', 'x' };
+    for (int i = 0; i < BENCH_PIXELS; i++) {
+        in.hue[i] = i * 257;
+        in.sat[i] = 254 - (i % 255);
+        in.bri[i] = 1 + (i % 254);
+        in.ct[i] = FAUXMO_COLOR_CT_MIN + (i * (FAUXMO_COLOR_CT_MAX - FAUXMO_COLOR_CT_MIN)) / BENCH_PIXELS;
+        in.x[i] = 6000 + i * 160;
+        in.y[i] = 4000 + ((i * 97) % 256) * 160;
+        in.rgb[i] = { (uint8_t) i, (uint8_t) (i * 3), (uint8_t) (255 - i) };
+        in.colors[i] = { modes[i % 3], in.bri[i], in.hue[i], in.sat[i], in.ct[i], in.x[i], in.y[i] };
+    }
+
+    printf("\n%-16s %12s %14s\n", "conversion", "ns/pixel", "Mpixel/s");
+
+    _colorRow("hs2rgb", iterations, [&]() {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_PIXELS; i++) sum += fauxmo_hs2rgb(in.hue[i], in.sat[i], in.bri[i]).r;
+        return sum;
+    });
+    _colorRow("ct2rgb", iterations, [&]() {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_PIXELS; i++) sum += fauxmo_ct2rgb(in.ct[i], in.bri[i]).r;
+        return sum;
+    });
+    _colorRow("xy2rgb", iterations, [&]() {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_PIXELS; i++) sum += fauxmo_xy2rgb(in.x[i], in.y[i], in.bri[i]).r;
+        return sum;
+    });
+    _colorRow("rgb2hs", iterations, [&]() {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_PIXELS; i++) {
+            uint16_t hue;
+            uint8_t sat;
+            fauxmo_rgb2hs(in.rgb[i], &hue, &sat);
+            sum += hue + sat;
+        }
+        return sum;
+    });
+    _colorRow("rgb2rgbw", iterations, [&]() {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_PIXELS; i++) sum += fauxmo_rgb2rgbw(in.rgb[i]).w;
+        return sum;
+    });
+    _colorRow("color2rgb", iterations, [&]() {
+        uint32_t sum = 0;
+        for (int i = 0; i < BENCH_PIXELS; i++) sum += fauxmo_color2rgb(&in.colors[i]).r;
+        return sum;
+    });
+    _colorRow("hs2rgb_n rgb", iterations, [&]() {
+        fauxmo_hs2rgb_n(in.hue, in.sat, in.bri, in.out, BENCH_PIXELS, 3);
+        return (uint32_t) in.out[0];
+    });
+    _colorRow("hs2rgb_n rgbw", iterations, [&]() {
+        fauxmo_hs2rgb_n(in.hue, in.sat, in.bri, in.out, BENCH_PIXELS, 4);
+        return (uint32_t) in.out[0];
+    });
+    _colorRow("color2rgb_n rgb", iterations, [&]() {
+        fauxmo_color2rgb_n(in.colors, in.out, BENCH_PIXELS, 3);
+        return (uint32_t) in.out[0];
+    });
+    _colorRow("color2rgb_n rgbw", iterations, [&]() {
+        fauxmo_color2rgb_n(in.colors, in.out, BENCH_PIXELS, 4);
+        return (uint32_t) in.out[0];
+    });
+
+}
+
+int main(int argc, char ** argv) {
+
+    int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+    if (iterations < 1) iterations = 1;
+    const int sizes[] = { 1, 16, 64, 255 };
+
+    printf("%-12s %7s %12s %14s %12s %10s\n", "request", "devices", "ns/request", "allocs/request", "peak heap", "response");
+
+    for (int size : sizes) {
+
+        fauxmoESP fauxmo;
+        for (int i = 0; i < size; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "light %d", i);
+            fauxmo.addDevice(name);
+        }
+        fauxmo.setRateLimit(0);
+        fauxmo.enable(true);
+
+        char control[64];
+        snprintf(control, sizeof(control), "/api/user/lights/%d/state", size);
+        const scenario_t scenarios[] = {
+            { "connect", hostHttp("GET", "/nothing") },
+            { "ssdp", "" },
+            { "description", hostHttp("GET", "/description.xml") },
+            { "list", hostHttp("GET", "/api/user/lights") },
+            { "light", hostHttp("GET", "/api/user/lights/1") },
+            { "control", hostHttp("PUT", control, "{\"on\": true, \"bri\": 128, \"hue\": 1000, \"sat\": 200}") }
+        };
+
+        for (const scenario_t & scenario : scenarios) _run(fauxmo, scenario, size, iterations);
+        _runUpdates(fauxmo, size, iterations, false);
+        _runUpdates(fauxmo, size, iterations, true);
+
+    }
+
+    _runColors(iterations);
+
+    return 0;
+
+}
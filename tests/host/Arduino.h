@@ -0,0 +1,136 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// Host stand-in for the parts of the Arduino core fauxmoESP uses, so the
+// library builds and runs natively (see tests/CMakeLists.txt).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <atomic>
+#include <string>
+
+#define PROGMEM
+#define PSTR(s)                     (s)
+#define PGM_P                       const char *
+#define strlen_P                    strlen
+#define snprintf_P                  snprintf
+#define pgm_read_byte(p)            (*(const uint8_t *)(p))
+#define pgm_read_word(p)            (*(const uint16_t *)(p))
+#define pgm_read_dword(p)           (*(const uint32_t *)(p))
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// Milliseconds since start on a monotonic clock, plus whatever hostAdvance() added
+unsigned long millis();
+void hostAdvance(unsigned long ms);
+
+// ESP32 critical section, a spinlock so the seqlock writers are really serialized
+typedef struct {
+    std::atomic_flag flag;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { ATOMIC_FLAG_INIT }
+
+inline void portENTER_CRITICAL(portMUX_TYPE * mux) {
+    while (mux->flag.test_and_set(std::memory_order_acquire)) {}
+}
+
+inline void portEXIT_CRITICAL(portMUX_TYPE * mux) {
+    mux->flag.clear(std::memory_order_release);
+}
+
+class String {
+
+    public:
+
+        String() {}
+        String(const char * text) : _text(text ? text : "") {}
+        const char * c_str() const { return _text.c_str(); }
+        unsigned int length() const { return _text.length(); }
+        bool operator==(const char * text) const { return _text == text; }
+
+    private:
+
+        std::string _text;
+
+};
+
+class IPAddress {
+
+    public:
+
+        IPAddress() : _address(0) {}
+        IPAddress(uint32_t address) : _address(address) {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | (b << 8) | (c << 16) | ((uint32_t) d << 24)) {}
+        operator uint32_t() const { return _address; }
+        uint8_t operator[](int index) const { return (_address >> (8 * index)) & 0xFF; }
+        String toString() const {
+            char buffer[16];
+            snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+            return String(buffer);
+        }
+
+    private:
+
+        uint32_t _address;      // network order, like the cores
+
+};
+
+// Serial, so DEBUG_FAUXMO can be set to Serial in host builds
+class HardwareSerial {
+
+    public:
+
+        void begin(unsigned long) {}
+        int printf(const char * format, ...) __attribute__((format(printf, 2, 3))) {
+            va_list args;
+            va_start(args, format);
+            int n = vprintf(format, args);
+            va_end(args);
+            return n;
+        }
+        int printf_P(const char * format, ...) {
+            va_list args;
+            va_start(args, format);
+            int n = vprintf(format, args);
+            va_end(args);
+            return n;
+        }
+
+};
+
+extern HardwareSerial Serial;
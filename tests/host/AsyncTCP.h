@@ -0,0 +1,191 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// Host stand-in for AsyncTCP. There are no sockets: servers are found by
+// port with find(), accept() hands them a new client and the client is
+// driven with receive() and disconnect(). Whatever the library writes is
+// collected in output. hostLoopback (loopback.h) puts real sockets behind
+// them.
+//
+// As in AsyncTCP, close() runs the disconnect callback before returning
+// and the owner of the client (the library, once accepted) deletes it.
+// pollAll() plays the periodic lwIP poll, calling the poll callback of
+// every client (every 500ms on the devices).
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+class AsyncClient;
+
+typedef std::function<void(void *, AsyncClient *)> AcConnectHandler;
+typedef std::function<void(void *, AsyncClient *, size_t, uint32_t)> AcAckHandler;
+typedef std::function<void(void *, AsyncClient *, int8_t)> AcErrorHandler;
+typedef std::function<void(void *, AsyncClient *, void *, size_t)> AcDataHandler;
+typedef std::function<void(void *, AsyncClient *, uint32_t)> AcTimeoutHandler;
+
+class AsyncClient {
+
+    public:
+
+        AsyncClient(IPAddress ip = IPAddress(127, 0, 0, 1)) : _ip(ip) { _clients().push_back(this); }
+        ~AsyncClient() {
+            std::vector<AsyncClient *> & clients = _clients();
+            clients.erase(std::find(clients.begin(), clients.end(), this));
+            if (_deleted) *_deleted = true;
+        }
+
+        bool connected() { return _connected; }
+        IPAddress remoteIP() { return _ip; }
+
+        size_t write(const char * data) { return write(data, strlen(data)); }
+        size_t write(const char * data, size_t len) {
+            if (!_connected) return 0;
+            output.append(data, len);
+            return len;
+        }
+
+        void close(bool now = false) {
+            if (!_connected) return;
+            _connected = false;
+            if (_onClose) _onClose(this);
+            if (_onDisconnect) _onDisconnect(_disconnectArg, this);
+        }
+        void abort() { close(true); }
+
+        const char * errorToString(int8_t error) { return "ERR_HOST"; }
+
+        void onAck(AcAckHandler fn, void * arg = 0) {}
+        void onData(AcDataHandler fn, void * arg = 0) { _onData = fn; _dataArg = arg; }
+        void onDisconnect(AcConnectHandler fn, void * arg = 0) { _onDisconnect = fn; _disconnectArg = arg; }
+        void onError(AcErrorHandler fn, void * arg = 0) {}
+        void onTimeout(AcTimeoutHandler fn, void * arg = 0) {}
+        void onPoll(AcConnectHandler fn, void * arg = 0) { _onPoll = fn; _pollArg = arg; }
+        void setRxTimeout(uint32_t timeout) {}
+
+        // Host side, the remote end. The data is copied with a spare byte,
+        // like the pbufs the library gets on the devices.
+        void receive(const char * data, size_t len) {
+            if (!_connected || !_onData) return;
+            std::vector<char> copy(data, data + len + 1);
+            _onData(_dataArg, this, copy.data(), len);
+        }
+        void receive(const char * data) { receive(data, strlen(data)); }
+        void disconnect() { close(); }       // may delete the client
+        void watch(bool * deleted) { _deleted = deleted; }   // set to true when the client is deleted
+        void onClose(std::function<void(AsyncClient *)> fn) { _onClose = fn; }  // before the disconnect callback
+        static int count() { return _clients().size(); }
+
+        // The poll callbacks may delete clients, the ones gone are skipped
+        static void pollAll() {
+            std::vector<AsyncClient *> clients = _clients();
+            for (AsyncClient * client : clients) {
+                std::vector<AsyncClient *> & alive = _clients();
+                if (std::find(alive.begin(), alive.end(), client) == alive.end()) continue;
+                if (client->_connected && client->_onPoll) client->_onPoll(client->_pollArg, client);
+            }
+        }
+        std::string output;
+
+    private:
+
+        static std::vector<AsyncClient *> & _clients() {
+            static std::vector<AsyncClient *> clients;
+            return clients;
+        }
+
+        IPAddress _ip;
+        bool _connected = true;
+        AcDataHandler _onData;
+        void * _dataArg = 0;
+        AcConnectHandler _onDisconnect;
+        void * _disconnectArg = 0;
+        AcConnectHandler _onPoll;
+        void * _pollArg = 0;
+        bool * _deleted = NULL;
+        std::function<void(AsyncClient *)> _onClose;
+
+};
+
+class AsyncServer {
+
+    public:
+
+        AsyncServer(uint16_t port) : _port(port) {}
+        ~AsyncServer() { end(); }
+
+        void onClient(AcConnectHandler fn, void * arg = 0) { _onClient = fn; _clientArg = arg; }
+        void begin() { end(); _servers().push_back(this); }
+        void end() {
+            std::vector<AsyncServer *> & servers = _servers();
+            for (size_t i = 0; i < servers.size(); i++) {
+                if (servers[i] == this) {
+                    servers.erase(servers.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        // Host side
+        static AsyncServer * find(uint16_t port) {
+            std::vector<AsyncServer *> & servers = _servers();
+            for (size_t i = 0; i < servers.size(); i++) {
+                if (servers[i]->_port == port) return servers[i];
+            }
+            return NULL;
+        }
+        uint16_t port() { return _port; }
+
+        // New connection from ip, the client belongs to the library from now on.
+        // NULL if it was rejected (and deleted) straight away.
+        AsyncClient * accept(IPAddress ip = IPAddress(127, 0, 0, 1)) {
+            if (!_onClient) return NULL;
+            AsyncClient * client = new AsyncClient(ip);
+            bool deleted = false;
+            client->watch(&deleted);
+            _onClient(_clientArg, client);
+            if (deleted) return NULL;
+            client->watch(NULL);
+            return client;
+        }
+
+    private:
+
+        static std::vector<AsyncServer *> & _servers() {
+            static std::vector<AsyncServer *> servers;
+            return servers;
+        }
+
+        uint16_t _port;
+        AcConnectHandler _onClient;
+        void * _clientArg = 0;
+
+};
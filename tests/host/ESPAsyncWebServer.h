@@ -0,0 +1,130 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// Host stand-in for the part of ESPAsyncWebServer used by fauxmoWebHandler.
+// There is no server: the test builds the request, calls handleBody() with
+// the chunks and then handleRequest(), like the server does. Responses sent
+// with send() are only recorded, fauxmoESP writes its own to the client.
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <string>
+#include <vector>
+
+typedef enum {
+    HTTP_GET     = 0b00000001,
+    HTTP_POST    = 0b00000010,
+    HTTP_DELETE  = 0b00000100,
+    HTTP_PUT     = 0b00001000,
+    HTTP_PATCH   = 0b00010000,
+    HTTP_HEAD    = 0b00100000,
+    HTTP_OPTIONS = 0b01000000,
+    HTTP_ANY     = 0b01111111,
+} WebRequestMethod;
+
+typedef uint8_t WebRequestMethodComposite;
+
+class AsyncWebParameter {
+
+    public:
+
+        AsyncWebParameter(const char * name, const char * value, bool form) : _name(name), _value(value), _isForm(form) {}
+        const String & name() const { return _name; }
+        const String & value() const { return _value; }
+        bool isPost() const { return _isForm; }
+
+    private:
+
+        String _name;
+        String _value;
+        bool _isForm;
+
+};
+
+class AsyncWebServerRequest {
+
+    public:
+
+        AsyncWebServerRequest(AsyncClient * client, WebRequestMethod method, const char * url, size_t contentLength = 0) :
+            _client(client), _method(method), _url(url), _contentLength(contentLength) {}
+
+        // As in the server, whatever the handler left in _tempObject is freed with the request
+        ~AsyncWebServerRequest() {
+            free(_tempObject);
+            for (AsyncWebParameter * param : _params) delete param;
+        }
+
+        void * _tempObject = NULL;
+
+        AsyncClient * client() { return _client; }
+        WebRequestMethodComposite method() const { return _method; }
+        const String & url() const { return _url; }
+        size_t contentLength() const { return _contentLength; }
+
+        bool hasParam(const char * name, bool post = false, bool file = false) const {
+            return getParam(name, post, file) != NULL;
+        }
+        AsyncWebParameter * getParam(const char * name, bool post = false, bool file = false) const {
+            for (AsyncWebParameter * param : _params) {
+                if ((param->name() == name) && (param->isPost() == post)) return param;
+            }
+            return NULL;
+        }
+
+        void send(int code) { _code = code; }
+
+        // Host side
+        void addParam(const char * name, const char * value, bool post = false) {
+            _params.push_back(new AsyncWebParameter(name, value, post));
+        }
+        int code() const { return _code; }    // sent with send(), 0 if none
+
+    private:
+
+        AsyncClient * _client;
+        WebRequestMethodComposite _method;
+        String _url;
+        size_t _contentLength;
+        std::vector<AsyncWebParameter *> _params;
+        int _code = 0;
+
+};
+
+class AsyncWebHandler {
+
+    public:
+
+        virtual ~AsyncWebHandler() {}
+        virtual bool canHandle(AsyncWebServerRequest * request) { return false; }
+        virtual void handleRequest(AsyncWebServerRequest * request) {}
+        virtual void handleBody(AsyncWebServerRequest * request, uint8_t * data, size_t len, size_t index, size_t total) {}
+        virtual bool isRequestHandlerTrivial() { return true; }
+
+};
@@ -0,0 +1,53 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// Host stand-in for the WiFi library, a station with a fixed address
+
+#include <Arduino.h>
+
+class WiFiClass {
+
+    public:
+
+        IPAddress localIP() { return _ip; }
+        String macAddress() { return String(_mac); }
+
+        // Host side
+        void setLocalIP(IPAddress ip) { _ip = ip; }
+        void setMacAddress(const char * mac) { strncpy(_mac, mac, sizeof(_mac) - 1); }
+
+    private:
+
+        IPAddress _ip = IPAddress(127, 0, 0, 1);
+        char _mac[18] = "AA:BB:CC:DD:EE:FF";
+
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,147 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// Host stand-in for WiFiUDP. Sockets are found by port with find(), packets
+// are queued with inject() and the responses collected in sent, so a test
+// or benchmark plays the network.
+
+#include <Arduino.h>
+#include <deque>
+#include <vector>
+#include <functional>
+
+typedef struct {
+    IPAddress ip;
+    uint16_t port;
+    std::string data;
+} host_packet_t;
+
+class WiFiUDP {
+
+    public:
+
+        ~WiFiUDP() { stop(); }
+
+        uint8_t beginMulticast(IPAddress multicast, uint16_t port) {
+            stop();
+            _port = port;
+            _sockets().push_back(this);
+            return 1;
+        }
+        uint8_t beginMulticast(IPAddress local, IPAddress multicast, uint16_t port) { return beginMulticast(multicast, port); }
+
+        void stop() {
+            std::vector<WiFiUDP *> & sockets = _sockets();
+            for (size_t i = 0; i < sockets.size(); i++) {
+                if (sockets[i] == this) {
+                    sockets.erase(sockets.begin() + i);
+                    break;
+                }
+            }
+            _port = 0;
+        }
+
+        int parsePacket() {
+            if (_current) _inbound.pop_front();
+            _current = !_inbound.empty();
+            return _current ? _inbound.front().data.size() : 0;
+        }
+
+        int read(unsigned char * buffer, size_t len) {
+            if (!_current) return 0;
+            const std::string & data = _inbound.front().data;
+            if (len > data.size()) len = data.size();
+            memcpy(buffer, data.data(), len);
+            return len;
+        }
+
+        IPAddress remoteIP() { return _current ? _inbound.front().ip : IPAddress(); }
+        uint16_t remotePort() { return _current ? _inbound.front().port : 0; }
+
+        int beginPacket(IPAddress ip, uint16_t port) {
+            _outbound.ip = ip;
+            _outbound.port = port;
+            _outbound.data.clear();
+            return 1;
+        }
+
+        size_t write(const char * data) {
+            _outbound.data += data;
+            return strlen(data);
+        }
+
+        // AsyncUDP on the ESP32 uses the response as a format
+        size_t printf(const char * format, ...) {
+            char buffer[1024];
+            va_list args;
+            va_start(args, format);
+            int n = vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            return (n > 0) ? write(buffer) : 0;
+        }
+
+        int endPacket() {
+            if (onSend) {
+                onSend(_outbound);
+            } else {
+                sent.push_back(_outbound);
+            }
+            return 1;
+        }
+
+        // Host side
+        static WiFiUDP * find(uint16_t port) {
+            std::vector<WiFiUDP *> & sockets = _sockets();
+            for (size_t i = 0; i < sockets.size(); i++) {
+                if (sockets[i]->_port == port) return sockets[i];
+            }
+            return NULL;
+        }
+        void inject(const char * data, size_t len, IPAddress ip = IPAddress(127, 0, 0, 1), uint16_t port = 1900) {
+            host_packet_t packet = { ip, port, std::string(data, len) };
+            _inbound.push_back(packet);
+        }
+        uint16_t port() { return _port; }
+        std::vector<host_packet_t> sent;
+        std::function<void(const host_packet_t &)> onSend;  // replaces sent
+
+    private:
+
+        static std::vector<WiFiUDP *> & _sockets() {
+            static std::vector<WiFiUDP *> sockets;
+            return sockets;
+        }
+
+        std::deque<host_packet_t> _inbound;
+        bool _current = false;
+        host_packet_t _outbound;
+        uint16_t _port = 0;
+
+};
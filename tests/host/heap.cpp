@@ -0,0 +1,120 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#include "heap.h"
+#include <malloc.h>
+#include <atomic>
+
+extern "C" {
+    void * __libc_malloc(size_t size);
+    void * __libc_calloc(size_t count, size_t size);
+    void * __libc_realloc(void * ptr, size_t size);
+    void * __libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void * ptr);
+}
+
+static std::atomic<size_t> _allocs(0);
+static std::atomic<size_t> _frees(0);
+static std::atomic<size_t> _current(0);
+static std::atomic<size_t> _peak(0);
+
+static void _grow(void * ptr) {
+    if (!ptr) return;
+    size_t current = _current += malloc_usable_size(ptr);
+    size_t peak = _peak;
+    while ((current > peak) && !_peak.compare_exchange_weak(peak, current)) {}
+}
+
+static void _shrink(void * ptr) {
+    if (!ptr) return;
+    _current -= malloc_usable_size(ptr);
+}
+
+extern "C" {
+
+void * malloc(size_t size) {
+    void * ptr = __libc_malloc(size);
+    _allocs++;
+    _grow(ptr);
+    return ptr;
+}
+
+void * calloc(size_t count, size_t size) {
+    void * ptr = __libc_calloc(count, size);
+    _allocs++;
+    _grow(ptr);
+    return ptr;
+}
+
+void * realloc(void * ptr, size_t size) {
+    if (ptr && (0 == size)) {
+        free(ptr);
+        return NULL;
+    }
+    _shrink(ptr);
+    void * moved = __libc_realloc(ptr, size);
+    _allocs++;
+    _grow(moved ? moved : ptr);     // a failed realloc leaves the block where it was
+    return moved;
+}
+
+void * memalign(size_t alignment, size_t size) {
+    void * ptr = __libc_memalign(alignment, size);
+    _allocs++;
+    _grow(ptr);
+    return ptr;
+}
+
+void * aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void ** ptr, size_t alignment, size_t size) {
+    *ptr = memalign(alignment, size);
+    return *ptr ? 0 : 12;   // ENOMEM
+}
+
+void free(void * ptr) {
+    if (!ptr) return;
+    _frees++;
+    _shrink(ptr);
+    __libc_free(ptr);
+}
+
+}
+
+host_heap_t heapStats() {
+    host_heap_t stats = { _allocs, _frees, _current, _peak };
+    return stats;
+}
+
+void heapReset() {
+    _allocs = 0;
+    _frees = 0;
+    _peak = _current.load();
+}
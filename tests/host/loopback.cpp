@@ -0,0 +1,254 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#include "loopback.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int _socket(int type, uint16_t port) {
+
+    int fd = socket(AF_INET, type, 0);
+    if (fd < 0) return -1;
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if ((bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) ||
+        ((SOCK_STREAM == type) && (listen(fd, 128) < 0))) {
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+
+}
+
+bool hostLoopback::begin(const std::vector<uint16_t> & tcpPorts, uint16_t udpPort, uint16_t localUdpPort, std::function<void()> handle) {
+
+    end();
+    _handle = handle;
+
+    for (uint16_t port : tcpPorts) {
+        int fd = _socket(SOCK_STREAM, port);
+        if (fd < 0) {
+            end();
+            return false;
+        }
+        listener_t listener = { fd, port };
+        _listeners.push_back(listener);
+    }
+
+    _udpSocket = WiFiUDP::find(localUdpPort);
+    if (_udpSocket) {
+        _udpFd = _socket(SOCK_DGRAM, udpPort);
+        if (_udpFd < 0) {
+            end();
+            return false;
+        }
+        int fd = _udpFd;
+        _udpSocket->onSend = [fd](const host_packet_t & packet) {
+            struct sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = (uint32_t) packet.ip;
+            address.sin_port = htons(packet.port);
+            sendto(fd, packet.data.data(), packet.data.size(), 0, (struct sockaddr *) &address, sizeof(address));
+        };
+    }
+
+    return true;
+
+}
+
+void hostLoopback::end() {
+
+    for (connection_t & connection : _connections) {
+        if (connection.client) {
+            connection.client->watch(NULL);
+            connection.client->onClose(NULL);
+        }
+        close(connection.fd);
+    }
+    _connections.clear();
+
+    for (listener_t & listener : _listeners) close(listener.fd);
+    _listeners.clear();
+
+    if (_udpSocket) _udpSocket->onSend = NULL;
+    _udpSocket = NULL;
+    if (_udpFd >= 0) close(_udpFd);
+    _udpFd = -1;
+
+}
+
+void hostLoopback::poll(int timeout) {
+
+    // Stands in for the lwIP poll of the connections
+    AsyncClient::pollAll();
+
+    std::vector<struct pollfd> fds;
+    for (listener_t & listener : _listeners) fds.push_back({ listener.fd, POLLIN, 0 });
+    if (_udpFd >= 0) fds.push_back({ _udpFd, POLLIN, 0 });
+    for (connection_t & connection : _connections) {
+        fds.push_back({ connection.fd, (short) (POLLIN | (connection.out.empty() ? 0 : POLLOUT)), 0 });
+    }
+
+    if (::poll(fds.data(), fds.size(), timeout) <= 0) return;
+
+    // Connections first, so the ones accepted below are not looked up in fds
+    size_t index = _listeners.size() + ((_udpFd >= 0) ? 1 : 0);
+    for (std::list<connection_t>::iterator it = _connections.begin(); (it != _connections.end()) && (index < fds.size()); index++) {
+        connection_t & connection = *it;
+        if (fds[index].revents & (POLLIN | POLLHUP | POLLERR)) _receive(connection);
+        if (_flush(connection)) {
+            it++;
+        } else {
+            it = _connections.erase(it);
+        }
+    }
+
+    if ((_udpFd >= 0) && (fds[_listeners.size()].revents & POLLIN)) _udp();
+
+    for (size_t i = 0; i < _listeners.size(); i++) {
+        if (fds[i].revents & POLLIN) _accept(_listeners[i]);
+    }
+
+    // Whatever the library wrote or closed from outside the callbacks (timers)
+    for (std::list<connection_t>::iterator it = _connections.begin(); it != _connections.end(); ) {
+        if (_flush(*it)) {
+            it++;
+        } else {
+            it = _connections.erase(it);
+        }
+    }
+
+}
+
+void hostLoopback::_accept(listener_t & listener) {
+
+    // One at a time: a connection queued after poll() returned could come from
+    // a client whose previous connection is closed but not seen as closed yet
+    struct sockaddr_in address = {};
+    socklen_t len = sizeof(address);
+    int fd = accept(listener.fd, (struct sockaddr *) &address, &len);
+    if (fd < 0) return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    AsyncServer * server = AsyncServer::find(listener.port);
+    AsyncClient * client = server ? server->accept(IPAddress((uint32_t) address.sin_addr.s_addr)) : NULL;
+    if (!client) {
+        refused++;
+        close(fd);
+        return;
+    }
+    accepted++;
+
+    _connections.push_back({ fd, client, false, false, "" });
+    connection_t & connection = _connections.back();
+    client->watch(&connection.deleted);
+    client->onClose([&connection](AsyncClient * c) {
+        connection.out += c->output;
+        c->output.clear();
+        connection.closing = true;
+    });
+
+}
+
+void hostLoopback::_receive(connection_t & connection) {
+
+    char buffer[2048];
+    ssize_t len = recv(connection.fd, buffer, sizeof(buffer), 0);
+    if ((len < 0) && ((EAGAIN == errno) || (EWOULDBLOCK == errno))) return;
+
+    if (connection.deleted) connection.client = NULL;
+    bool open = connection.client && connection.client->connected();
+
+    if (len > 0) {
+        if (open) connection.client->receive(buffer, len);
+    } else {
+        // The remote end closed, the library deletes its client
+        if (open) connection.client->disconnect();
+        connection.closing = true;
+    }
+
+}
+
+bool hostLoopback::_flush(connection_t & connection) {
+
+    if (connection.deleted) connection.client = NULL;
+    if (connection.client) {
+        connection.out += connection.client->output;
+        connection.client->output.clear();
+    }
+
+    while (!connection.out.empty()) {
+        ssize_t sent = send(connection.fd, connection.out.data(), connection.out.size(), MSG_NOSIGNAL);
+        if (sent > 0) {
+            connection.out.erase(0, sent);
+            continue;
+        }
+        if ((sent < 0) && ((EAGAIN == errno) || (EWOULDBLOCK == errno))) return true;
+
+        // Gone, let the library know
+        connection.out.clear();
+        if (connection.client && connection.client->connected()) connection.client->disconnect();
+        connection.closing = true;
+    }
+
+    if (!connection.closing) return true;
+
+    if (connection.client && !connection.deleted) {
+        connection.client->watch(NULL);
+        connection.client->onClose(NULL);
+    }
+    close(connection.fd);
+    return false;
+
+}
+
+void hostLoopback::_udp() {
+
+    while (true) {
+        char buffer[1500];
+        struct sockaddr_in address = {};
+        socklen_t len = sizeof(address);
+        ssize_t n = recvfrom(_udpFd, buffer, sizeof(buffer), 0, (struct sockaddr *) &address, &len);
+        if (n <= 0) return;
+        _udpSocket->inject(buffer, n, IPAddress((uint32_t) address.sin_addr.s_addr), ntohs(address.sin_port));
+        if (_handle) _handle();
+    }
+
+}
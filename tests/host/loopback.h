@@ -0,0 +1,87 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// Real loopback sockets behind the AsyncServer and WiFiUDP stand-ins, so
+// fauxmoESP can be driven by actual network clients (see tests/load.cpp).
+// Everything happens in the thread calling poll(), the way AsyncTCP runs
+// the library from a single task.
+
+#include <AsyncTCP.h>
+#include <WiFiUdp.h>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+
+class hostLoopback {
+
+    public:
+
+        ~hostLoopback() { end(); }
+
+        // Listens on 127.0.0.1 for every AsyncServer port in tcpPorts, and on
+        // udpPort for the WiFiUDP socket bound to localUdpPort. handle is
+        // called after every UDP packet, so it is processed before the next.
+        bool begin(const std::vector<uint16_t> & tcpPorts, uint16_t udpPort, uint16_t localUdpPort, std::function<void()> handle);
+        void end();
+
+        // Waits up to timeout ms for traffic and serves it
+        void poll(int timeout);
+
+        size_t accepted = 0;        // connections handed to the library
+        size_t refused = 0;         // closed by the library as soon as they were accepted
+
+    private:
+
+        typedef struct {
+            int fd;
+            AsyncClient * client;   // NULL once the library deleted it
+            bool deleted;
+            bool closing;           // closed by the library, close the socket once flushed
+            std::string out;
+        } connection_t;
+
+        typedef struct {
+            int fd;
+            uint16_t port;
+        } listener_t;
+
+        void _accept(listener_t & listener);
+        void _receive(connection_t & connection);
+        void _udp();
+        bool _flush(connection_t & connection);   // false when the connection is gone
+
+        std::vector<listener_t> _listeners;
+        std::list<connection_t> _connections;
+        int _udpFd = -1;
+        WiFiUDP * _udpSocket = NULL;
+        std::function<void()> _handle;
+
+};
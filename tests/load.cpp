@@ -0,0 +1,572 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// Discovery storm simulator. fauxmoESP runs on real loopback sockets
+// (hostLoopback) and a number of simulated Echos replay conversation
+// scripts (tests/scripts) against it at the same time, each from its own
+// 127.0.0.x address, as separate devices on a LAN would.
+//
+// Reports throughput, latency percentiles, connections the library
+// rejected and how long each Echo took to go through its script (the
+// discovery completion time for the discovery script).
+//
+// load --echos 8 --devices 64 --segment 40 --gap 5 --script scripts/discovery.txt
+
+#include "test.h"
+#include "loopback.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LOAD_USER               "2WLEDHardQrI3WHYTHoMcXHgEspsM8ZZRpSKtBQr"
+#define LOAD_RECEIVE_TIMEOUT    15000   // ms, longer than FAUXMO_TCP_IDLE_TIMEOUT
+#define LOAD_SEARCH_TIMEOUT     1000    // ms to wait for the SSDP responses
+#define LOAD_SEARCH_RETRIES     3
+
+// -----------------------------------------------------------------------------
+// Scripts
+// -----------------------------------------------------------------------------
+
+typedef enum {
+    STEP_SEARCH,
+    STEP_REQUEST,
+    STEP_EACH,          // the request once per light
+    STEP_RANDOM,        // the request for a random light
+    STEP_SLEEP
+} step_type_t;
+
+typedef struct {
+    step_type_t type;
+    std::string method;
+    std::string url;
+    std::string body;   // or the ST of a search
+    int ms;
+} step_t;
+
+typedef struct {
+    std::string name;
+    std::vector<step_t> steps;
+} script_t;
+
+static bool _loadScript(const char * path, script_t & script) {
+
+    std::ifstream file(path);
+    if (!file) return false;
+
+    script.name = path;
+    size_t slash = script.name.rfind('/');
+    if (slash != std::string::npos) script.name = script.name.substr(slash + 1);
+
+    std::string line;
+    while (std::getline(file, line)) {
+
+        std::istringstream words(line);
+        std::string word;
+        if (!(words >> word) || ('#' == word[0])) continue;
+
+        step_t step = { STEP_REQUEST, "", "", "", 0 };
+        if ("search" == word) {
+            step.type = STEP_SEARCH;
+            words >> step.body;
+        } else if ("sleep" == word) {
+            step.type = STEP_SLEEP;
+            words >> step.ms;
+        } else {
+            if (("each" == word) || ("random" == word)) {
+                step.type = ("each" == word) ? STEP_EACH : STEP_RANDOM;
+                words >> word;
+            }
+            std::transform(word.begin(), word.end(), word.begin(), ::toupper);
+            step.method = word;
+            words >> step.url;
+            std::getline(words, step.body);
+            step.body.erase(0, step.body.find_first_not_of(' '));
+            if (("GET" != step.method) && ("PUT" != step.method) && ("POST" != step.method)) {
+                fprintf(stderr, "%s: unknown step '%s'\n", path, line.c_str());
+                return false;
+            }
+        }
+        script.steps.push_back(step);
+
+    }
+
+    return !script.steps.empty();
+
+}
+
+// -----------------------------------------------------------------------------
+// Simulated Echo
+// -----------------------------------------------------------------------------
+
+typedef struct {
+    int devices;
+    int bridges;
+    int perBridge;
+    uint16_t tcpPort;
+    uint16_t udpPort;
+    int runs;
+    size_t segment;     // bytes per TCP segment, 0 for the whole request at once
+    int gap;            // ms between segments
+    int think;          // ms between steps
+    int jitter;         // random ms added to think, and before the first run
+    bool sameIP;
+} options_t;
+
+typedef struct {
+    size_t ok = 0;
+    size_t failed = 0;          // closed by fauxmoESP without a response
+    size_t errors = 0;          // could not connect, or no response in time
+    std::vector<double> latencies;      // ms, successful requests
+    std::vector<double> completions;    // ms, complete runs of a script
+    size_t incomplete = 0;
+} results_t;
+
+class echo {
+
+    public:
+
+        echo(int index, const options_t & options, const std::vector<script_t> & scripts, results_t & results)
+            : _options(options), _scripts(scripts), _results(results), _random(index) {
+            _ip = htonl(INADDR_LOOPBACK + 10 + (options.sameIP ? 0 : index));
+        }
+
+        void run() {
+            if (_options.jitter > 0) _sleep(_random() % _options.jitter);
+            for (int i = 0; i < _options.runs; i++) {
+                const script_t & script = _scripts[i % _scripts.size()];
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                if (_run(script)) {
+                    _results.completions.push_back(_elapsed(start));
+                } else {
+                    _results.incomplete++;
+                }
+            }
+        }
+
+    private:
+
+        static double _elapsed(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        static void _sleep(int ms) {
+            if (ms > 0) usleep(ms * 1000);
+        }
+
+        int _socket(int type) {
+            int fd = socket(AF_INET, type, 0);
+            if (fd < 0) return -1;
+            struct sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = _ip;
+            if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+                close(fd);
+                return -1;
+            }
+            struct timeval timeout = { LOAD_RECEIVE_TIMEOUT / 1000, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+
+        // M-SEARCH, returns the ports of the bridges that answered
+        std::vector<uint16_t> _search(const std::string & st) {
+
+            std::vector<uint16_t> ports;
+            int fd = _socket(SOCK_DGRAM);
+            if (fd < 0) return ports;
+            struct timeval timeout = { 0, 100000 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            char request[256];
+            snprintf(request, sizeof(request),
+                "M-SEARCH * HTTP/1.1\r\nHOST: 239.255.255.250:1900\r\nMAN: \"ssdp:discover\"\r\nMX: 3\r\nST: %s\r\n\r\n", st.c_str());
+            struct sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(_options.udpPort);
+
+            for (int retry = 0; (retry < LOAD_SEARCH_RETRIES) && ((int) ports.size() < _options.bridges); retry++) {
+                sendto(fd, request, strlen(request), 0, (struct sockaddr *) &address, sizeof(address));
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                while (((int) ports.size() < _options.bridges) && (_elapsed(start) < LOAD_SEARCH_TIMEOUT)) {
+                    char response[1500];
+                    ssize_t len = recv(fd, response, sizeof(response) - 1, 0);
+                    if (len <= 0) continue;
+                    response[len] = 0;
+                    const char * location = strstr(response, "LOCATION: http://");
+                    const char * colon = location ? strchr(location + 17, ':') : NULL;
+                    if (!colon) continue;
+                    uint16_t port = atoi(colon + 1);
+                    if (std::find(ports.begin(), ports.end(), port) == ports.end()) ports.push_back(port);
+                }
+            }
+
+            close(fd);
+            std::sort(ports.begin(), ports.end());
+            return ports;
+
+        }
+
+        // One request on its own connection, returns the HTTP status (0 if none)
+        int _request(uint16_t port, const std::string & method, const std::string & url, const std::string & body, std::string & response) {
+
+            response.clear();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            int fd = _socket(SOCK_STREAM);
+            int yes = 1;
+            if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            struct sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(port);
+            if ((fd < 0) || (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0)) {
+                if (fd >= 0) close(fd);
+                _results.errors++;
+                return 0;
+            }
+
+            // In segments, as slow or fragmented clients send it
+            std::string request = hostHttp(method.c_str(), url.c_str(), body.c_str());
+            size_t segment = (_options.segment > 0) ? _options.segment : request.size();
+            for (size_t sent = 0; sent < request.size(); sent += segment) {
+                if (sent > 0) _sleep(_options.gap);
+                if (send(fd, request.data() + sent, std::min(segment, request.size() - sent), MSG_NOSIGNAL) <= 0) break;
+            }
+
+            // Until the whole body is in, or the connection is closed
+            bool timeout = false;
+            size_t expected = 0;
+            while (true) {
+                char buffer[4096];
+                ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+                if (len <= 0) {
+                    timeout = (len < 0) && ((EAGAIN == errno) || (EWOULDBLOCK == errno));
+                    break;
+                }
+                response.append(buffer, len);
+                size_t headers = response.find("\r\n\r\n");
+                if (headers == std::string::npos) continue;
+                if (0 == expected) {
+                    const char * length = strcasestr(response.c_str(), "Content-Length:");
+                    expected = headers + 4 + (length ? atoi(length + 15) : 0);
+                }
+                if (response.size() >= expected) break;
+            }
+            close(fd);
+
+            int status = (response.compare(0, 5, "HTTP/") == 0) ? atoi(response.c_str() + 9) : 0;
+            if ((status >= 200) && (status < 300) && (response.size() >= expected)) {
+                _results.ok++;
+                _results.latencies.push_back(_elapsed(start));
+                response = hostBody(response);
+                return status;
+            }
+            if (timeout) {
+                _results.errors++;
+            } else {
+                _results.failed++;
+            }
+            return 0;
+
+        }
+
+        static std::string _replace(std::string text, const char * key, const std::string & value) {
+            size_t pos;
+            while ((pos = text.find(key)) != std::string::npos) text.replace(pos, strlen(key), value);
+            return text;
+        }
+
+        bool _step(uint16_t port, const step_t & step, int id) {
+            std::string url = _replace(_replace(step.url, "{user}", _user), "{id}", std::to_string(id));
+            std::string body = _replace(step.body, "{id}", std::to_string(id));
+            std::string response;
+            if (0 == _request(port, step.method, url, body, response)) return false;
+
+            // Learn the username and the lights, like an Echo would
+            size_t pos = response.find("\"username\": \"");
+            if (pos != std::string::npos) _user = response.substr(pos + 13, response.find('"', pos + 13) - pos - 13);
+            if ((url.size() >= 7) && (url.compare(url.size() - 7, 7, "/lights") == 0)) {
+                _lights = 0;
+                for (pos = response.find("\"uniqueid\""); pos != std::string::npos; pos = response.find("\"uniqueid\"", pos + 1)) _lights++;
+            }
+            return true;
+        }
+
+        bool _run(const script_t & script) {
+
+            // Bridges found by the last search, all of them if the script does not search
+            std::vector<uint16_t> ports;
+            for (int i = 0; i < _options.bridges; i++) ports.push_back(_options.tcpPort + i);
+            size_t first = 0;
+            if (STEP_SEARCH == script.steps[0].type) {
+                ports = _search(script.steps[0].body);
+                if (ports.empty()) return false;
+                first = 1;
+            }
+
+            bool success = true;
+            for (uint16_t port : ports) {
+
+                _user = LOAD_USER;
+                int bridge = port - _options.tcpPort;
+                _lights = (_options.perBridge > 0) ? std::min(_options.perBridge, _options.devices - bridge * _options.perBridge) : _options.devices;
+                int id = 1;
+
+                for (size_t i = first; i < script.steps.size(); i++) {
+                    const step_t & step = script.steps[i];
+                    if (i > first) _sleep(_options.think + ((_options.jitter > 0) ? _random() % _options.jitter : 0));
+                    switch (step.type) {
+                        case STEP_SLEEP:
+                            _sleep(step.ms);
+                            break;
+                        case STEP_EACH:
+                            for (id = 1; id <= _lights; id++) success &= _step(port, step, id);
+                            id = 1;
+                            break;
+                        case STEP_RANDOM:
+                            id = (_lights > 0) ? 1 + _random() % _lights : 1;
+                            success &= _step(port, step, id);
+                            break;
+                        case STEP_REQUEST:
+                            success &= _step(port, step, id);
+                            break;
+                        default:
+                            break;
+                    }
+                }
+
+            }
+
+            return success;
+
+        }
+
+        const options_t & _options;
+        const std::vector<script_t> & _scripts;
+        results_t & _results;
+        std::minstd_rand _random;
+        uint32_t _ip;
+        std::string _user = LOAD_USER;
+        int _lights = 0;
+
+};
+
+// -----------------------------------------------------------------------------
+// Report
+// -----------------------------------------------------------------------------
+
+static double _percentile(std::vector<double> & values, double p) {
+    if (values.empty()) return 0;
+    size_t index = std::min(values.size() - 1, (size_t) (p / 100.0 * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void _usage() {
+    printf(
+        "Usage: load [options]\n"
+        "  --echos N        simulated Echos running at the same time (8)\n"
+        "  --runs N         scripts each Echo runs, cycling through the scripts (1)\n"
+        "  --script FILE    conversation to replay, can be repeated (scripts/discovery.txt)\n"
+        "  --devices N      devices in fauxmoESP (16)\n"
+        "  --per-bridge N   devices per bridge, 0 for a single bridge (0)\n"
+        "  --segment N      send the requests in segments of N bytes (whole request)\n"
+        "  --gap MS         between segments (0)\n"
+        "  --think MS       between the steps of a script (0)\n"
+        "  --jitter MS      random extra think time, and start delay (0)\n"
+        "  --same-ip        all the Echos use the same address\n"
+        "  --rate R         fauxmoESP rate limit, requests per second and IP (library default)\n"
+        "  --burst N        fauxmoESP rate limit burst (library default)\n"
+        "  --per-ip N       fauxmoESP connections per IP (library default)\n"
+        "  --port N         first TCP port (19101)\n"
+        "  --udp-port N     SSDP port (19100)\n"
+        "  --check          exit with an error if any script did not complete\n"
+    );
+}
+
+int main(int argc, char ** argv) {
+
+    options_t options = { 16, 1, 0, 19101, 19100, 1, 0, 0, 0, 0, false };
+    int echos = 8;
+    int rate = -1, burst = -1, perIP = -1;
+    bool check = false;
+    std::vector<script_t> scripts;
+
+    static struct option long_options[] = {
+        { "echos", required_argument, 0, 'e' },
+        { "runs", required_argument, 0, 'r' },
+        { "script", required_argument, 0, 'f' },
+        { "devices", required_argument, 0, 'n' },
+        { "per-bridge", required_argument, 0, 'b' },
+        { "segment", required_argument, 0, 's' },
+        { "gap", required_argument, 0, 'g' },
+        { "think", required_argument, 0, 't' },
+        { "jitter", required_argument, 0, 'j' },
+        { "same-ip", no_argument, 0, 'i' },
+        { "rate", required_argument, 0, 'R' },
+        { "burst", required_argument, 0, 'B' },
+        { "per-ip", required_argument, 0, 'P' },
+        { "port", required_argument, 0, 'p' },
+        { "udp-port", required_argument, 0, 'u' },
+        { "check", no_argument, 0, 'c' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "e:r:f:n:b:s:g:t:j:iR:B:P:p:u:ch", long_options, NULL)) != -1) {
+        switch (option) {
+            case 'e': echos = atoi(optarg); break;
+            case 'r': options.runs = atoi(optarg); break;
+            case 'f': {
+                script_t script;
+                if (!_loadScript(optarg, script)) {
+                    fprintf(stderr, "Cannot load script %s\n", optarg);
+                    return 1;
+                }
+                scripts.push_back(script);
+                break;
+            }
+            case 'n': options.devices = atoi(optarg); break;
+            case 'b': options.perBridge = atoi(optarg); break;
+            case 's': options.segment = atoi(optarg); break;
+            case 'g': options.gap = atoi(optarg); break;
+            case 't': options.think = atoi(optarg); break;
+            case 'j': options.jitter = atoi(optarg); break;
+            case 'i': options.sameIP = true; break;
+            case 'R': rate = atoi(optarg); break;
+            case 'B': burst = atoi(optarg); break;
+            case 'P': perIP = atoi(optarg); break;
+            case 'p': options.tcpPort = atoi(optarg); break;
+            case 'u': options.udpPort = atoi(optarg); break;
+            case 'c': check = true; break;
+            default: _usage(); return ('h' == option) ? 0 : 1;
+        }
+    }
+
+    if (scripts.empty()) {
+        script_t script;
+        if (!_loadScript(FAUXMO_SCRIPTS_DIR "/discovery.txt", script)) {
+            fprintf(stderr, "Cannot load the default script\n");
+            return 1;
+        }
+        scripts.push_back(script);
+    }
+    if ((echos < 1) || (echos > 200) || (options.runs < 1) || (options.devices < 1)) {
+        _usage();
+        return 1;
+    }
+
+    // The bridge, served from its own thread
+    fauxmoESP fauxmo;
+    fauxmo.setPort(options.tcpPort);
+    fauxmo.setMaxDevicesPerBridge(options.perBridge);
+    for (int i = 0; i < options.devices; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "light %d", i);
+        fauxmo.addDevice(name);
+    }
+    if (rate >= 0) fauxmo.setRateLimit(rate, (burst >= 0) ? burst : FAUXMO_TCP_RATE_BURST);
+    if (perIP >= 0) fauxmo.setMaxClientsPerIP(perIP);
+    fauxmo.enable(true);
+    options.bridges = fauxmo.getBridgeCount();
+
+    std::vector<uint16_t> ports;
+    for (int i = 0; i < options.bridges; i++) ports.push_back(options.tcpPort + i);
+    hostLoopback loopback;
+    if (!loopback.begin(ports, options.udpPort, FAUXMO_UDP_MULTICAST_PORT, [&fauxmo]() { fauxmo.handle(); })) {
+        fprintf(stderr, "Cannot listen on the loopback ports %u-%u/%u\n", options.tcpPort, options.tcpPort + options.bridges - 1, options.udpPort);
+        return 1;
+    }
+
+    std::atomic<bool> done(false);
+    std::thread server([&]() {
+        while (!done) {
+            loopback.poll(5);
+            fauxmo.handle();
+        }
+    });
+
+    // The storm
+    std::vector<results_t> results(echos);
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < echos; i++) {
+        threads.push_back(std::thread([&, i]() {
+            echo device(i, options, scripts, results[i]);
+            device.run();
+        }));
+    }
+    for (std::thread & thread : threads) thread.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    done = true;
+    server.join();
+
+    results_t total;
+    for (results_t & result : results) {
+        total.ok += result.ok;
+        total.failed += result.failed;
+        total.errors += result.errors;
+        total.incomplete += result.incomplete;
+        total.latencies.insert(total.latencies.end(), result.latencies.begin(), result.latencies.end());
+        total.completions.insert(total.completions.end(), result.completions.begin(), result.completions.end());
+    }
+
+    printf("echos %d, runs %d, scripts", echos, options.runs);
+    for (const script_t & script : scripts) printf(" %s", script.name.c_str());
+    printf(", %d devices in %d bridges, segments %zu bytes, gap %d ms, think %d+%d ms\n",
+        options.devices, options.bridges, options.segment, options.gap, options.think, options.jitter);
+    printf("requests    %zu ok, %zu rejected, %zu errors in %.2f s, %.0f requests/s\n",
+        total.ok, total.failed, total.errors, elapsed, total.ok / elapsed);
+    printf("latency     p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+        _percentile(total.latencies, 50), _percentile(total.latencies, 90),
+        _percentile(total.latencies, 99), _percentile(total.latencies, 100));
+    printf("completion  %zu/%zu scripts, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+        total.completions.size(), total.completions.size() + total.incomplete,
+        _percentile(total.completions, 50), _percentile(total.completions, 99), _percentile(total.completions, 100));
+
+    fauxmoesp_stats_t stats = fauxmo.getStats();
+    printf("fauxmoESP   %zu connections, rejected: %u not allowed, %u too many, %u per IP, %u rate, %u too large, timeouts: %u header, %u body, %u idle\n",
+        loopback.accepted + loopback.refused, stats.notAllowed, stats.tooManyClients, stats.tooManyPerIP,
+        stats.rateLimited, stats.tooLarge, stats.headerTimeouts, stats.bodyTimeouts, stats.idleTimeouts);
+
+    return (check && (total.incomplete > 0)) ? 1 : 0;
+
+}
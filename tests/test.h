@@ -0,0 +1,87 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// Bits shared by the host tests and benchmarks
+
+#include <stdio.h>
+#include <string>
+#include "fauxmoESP.h"
+
+static int _failures __attribute__((unused)) = 0;
+
+#define CHECK(condition) { \
+    if (!(condition)) { \
+        printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        _failures++; \
+    } \
+}
+
+#define TEST_RESULT()   ((_failures > 0) ? 1 : 0)
+
+#define HOST_SSDP_SEARCH \
+    "M-SEARCH * HTTP/1.1\r\n" \
+    "HOST: 239.255.255.250:1900\r\n" \
+    "MAN: \"ssdp:discover\"\r\n" \
+    "MX: 15\r\n" \
+    "ST: urn:schemas-upnp-org:device:basic:1\r\n\r\n"
+
+// Raw HTTP request, with Content-Length when there is a body
+inline std::string hostHttp(const char * method, const char * url, const char * body = "") {
+    char headers[256];
+    size_t len = strlen(body);
+    if (len > 0) {
+        snprintf(headers, sizeof(headers), "%s %s HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: %u\r\n\r\n", method, url, (unsigned int) len);
+    } else {
+        snprintf(headers, sizeof(headers), "%s %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", method, url);
+    }
+    return std::string(headers) + body;
+}
+
+// Connects to the server on port, sends the request in one segment and
+// returns the response, closing the connection afterwards
+inline std::string hostRequest(uint16_t port, const std::string & request, IPAddress ip = IPAddress(127, 0, 0, 1)) {
+    AsyncServer * server = AsyncServer::find(port);
+    if (!server) return "";
+    AsyncClient * client = server->accept(ip);
+    if (!client) return "";
+    bool deleted = false;
+    client->watch(&deleted);
+    client->receive(request.data(), request.size());
+    if (deleted) return "";
+    std::string response = client->output;
+    client->disconnect();
+    return response;
+}
+
+// Body of a response
+inline std::string hostBody(const std::string & response) {
+    size_t pos = response.find("\r\n\r\n");
+    return (pos == std::string::npos) ? "" : response.substr(pos + 4);
+}
@@ -0,0 +1,189 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// Request arena: behaviour of fauxmoArena, and a soak of mixed requests
+// checking the heap is left exactly as it was found
+
+#include "test.h"
+#include "heap.h"
+#include <malloc.h>
+
+static void testArena() {
+
+    fauxmoArena arena(64, 1024);
+    char * a = (char *) arena.alloc(10);
+    char * b = (char *) arena.alloc(10);
+    CHECK(a && b);
+    CHECK(b - a == 12);                 // 4 byte aligned
+    CHECK(64 == arena.capacity());
+
+    // Over the block, served from the heap until the next reset
+    char * c = (char *) arena.alloc(100);
+    CHECK(c != NULL);
+    memset(c, 1, 100);
+    arena.reset();
+    CHECK(124 == arena.capacity());
+
+    // The grown block fits the same request without overflow
+    heapReset();
+    arena.alloc(10);
+    arena.alloc(10);
+    arena.alloc(100);
+    arena.reset();
+    CHECK(heapStats().allocs <= 1);
+
+}
+
+static void testArenaLimit() {
+
+    fauxmoArena arena(64, 256);
+
+    // Grows up to the limit, the rest of a larger request comes from the heap
+    arena.alloc(1000);
+    arena.reset();
+    CHECK(256 == arena.capacity());
+    for (int i = 0; i < 2; i++) {
+        void * a = arena.alloc(200);
+        void * b = arena.alloc(800);
+        CHECK(a && b);
+        arena.reset();
+    }
+    heapReset();
+    host_heap_t before = heapStats();
+    arena.alloc(200);
+    arena.alloc(800);
+    arena.reset();
+    host_heap_t after = heapStats();
+    CHECK(256 == arena.capacity());
+    CHECK((1 == after.allocs) && (1 == after.frees) && (after.current == before.current));
+
+    // A block over the limit is not kept either
+    fauxmoArena large(512, 128);
+    large.alloc(10);
+    large.reset();
+    CHECK(128 == large.capacity());
+
+}
+
+static void testListLimit() {
+
+    // A large light list does not leave more than the limit behind
+    fauxmoESP fauxmo;
+    for (int i = 0; i < 64; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "light number %d", i);
+        fauxmo.addDevice(name);
+    }
+    fauxmo.setRateLimit(0);
+    fauxmo.enable(true);
+    std::string request = hostHttp("GET", "/api/user/lights");
+    hostRequest(FAUXMO_TCP_PORT, hostHttp("GET", "/api/user/lights/1"));
+    heapReset();
+    host_heap_t before = heapStats();
+    std::string lights = hostBody(hostRequest(FAUXMO_TCP_PORT, request));
+    CHECK(lights.size() > FAUXMO_ARENA_MAX_SIZE);
+    lights.clear();
+    lights.shrink_to_fit();
+    host_heap_t after = heapStats();
+    CHECK(after.current <= before.current + FAUXMO_ARENA_MAX_SIZE);
+
+}
+
+static void testSoak() {
+
+    fauxmoESP fauxmo;
+    for (int i = 0; i < 64; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "light number %d", i);
+        fauxmo.addDevice(name, (fauxmoesp_device_type_t) (i % 4));
+    }
+    for (int g = 0; g < 4; g++) {
+        char name[16];
+        snprintf(name, sizeof(name), "group %d", g);
+        unsigned char id = fauxmo.addGroup(name);
+        for (int i = g; i < 64; i += 4) fauxmo.addDeviceToGroup(id, i);
+    }
+    fauxmo.setRateLimit(0);
+    fauxmo.enable(true);
+    WiFiUDP * udp = WiFiUDP::find(FAUXMO_UDP_MULTICAST_PORT);
+
+    std::string requests[6] = {
+        hostHttp("GET", "/description.xml"),
+        hostHttp("GET", "/api/user/lights"),
+        hostHttp("GET", "/api/user/lights/7"),
+        hostHttp("GET", "/api/user/groups"),
+        hostHttp("PUT", "/api/user/lights/3/state", "{\"on\": true, \"bri\": 128}"),
+        hostHttp("PUT", "/api/user/groups/2/action", "{\"on\": false}")
+    };
+    fauxmoesp_changed_t changes[64];
+
+    size_t responses = 0;
+    for (int round = 0; round < 2; round++) {
+
+        // The first round warms the arena and the library buffers up
+        int count = round ? 20000 : 200;
+        heapReset();
+        host_heap_t before = heapStats();
+        struct mallinfo2 info = mallinfo2();
+
+        for (int i = 0; i < count; i++) {
+            if (0 == i % 7) {
+                udp->inject(HOST_SSDP_SEARCH, strlen(HOST_SSDP_SEARCH));
+                fauxmo.handle();
+                udp->sent.clear();
+            } else {
+                responses += !hostBody(hostRequest(FAUXMO_TCP_PORT, requests[i % 6])).empty();
+            }
+            if (0 == i % 50) fauxmo.consumeChanges(changes, 64);
+        }
+
+        host_heap_t after = heapStats();
+        struct mallinfo2 info_after = mallinfo2();
+        if (round) {
+            printf("%d requests: %.1f allocations/request, in use %zu -> %zu bytes, peak +%zu bytes\n",
+                count, (double) after.allocs / count, before.current, after.current, after.peak - before.current);
+            printf("glibc heap: %zu -> %zu bytes, free in heap %zu -> %zu bytes\n",
+                info.arena, info_after.arena, info.fordblks, info_after.fordblks);
+            CHECK(after.current == before.current);
+            CHECK(after.allocs == after.frees);
+            CHECK(info_after.arena == info.arena);
+        }
+
+    }
+
+    CHECK(responses > 0);
+
+}
+
+int main() {
+    testArena();
+    testArenaLimit();
+    testListLimit();
+    testSoak();
+    return TEST_RESULT();
+}
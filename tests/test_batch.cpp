@@ -0,0 +1,148 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// setStates: batched application-side updates
+
+#include "test.h"
+
+int main() {
+
+    fauxmoESP fauxmo;
+    for (int i = 0; i < 32; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "channel %d", i);
+        fauxmo.addDevice(name, (i < 16) ? FAUXMO_DEVICE_COLOR : FAUXMO_DEVICE_DIMMABLE);
+    }
+    fauxmo.enable(true);
+
+    fauxmoesp_update_t updates[4] = {};
+    updates[0].name = "channel 3";
+    updates[0].fields = FAUXMO_CHANGE_STATE | FAUXMO_CHANGE_VALUE;
+    updates[0].state = false;
+    updates[0].value = 255;
+    updates[1].id = 20;
+    updates[1].fields = FAUXMO_CHANGE_VALUE;
+    updates[1].value = 30;
+    updates[2].name = "channel 3";                  // same device, applied after the first entry
+    updates[2].fields = FAUXMO_CHANGE_HUE;
+    updates[2].hue = 5000;
+    updates[2].sat = 200;
+    updates[3].name = "nowhere";
+    updates[3].fields = FAUXMO_CHANGE_STATE;
+
+    CHECK(3 == fauxmo.setStates(updates, 4));
+    CHECK(3 == updates[0].id);
+    CHECK(3 == updates[2].id);
+
+    fauxmoesp_state_t state;
+    fauxmo.getState("channel 3", &state);
+    CHECK(!state.state && (254 == state.value) && (5000 == state.hue) && (200 == state.sat) && ('h' == state.mode));
+    fauxmo.getState((uint16_t) 20, &state);
+    CHECK(state.state && (30 == state.value));
+
+    // Application changes are not reported as Hue changes
+    CHECK(0 == fauxmo.getGeneration());
+
+    // The ids found are checked again, renamed devices are looked up
+    fauxmo.renameDevice("channel 3", "channel three");
+    fauxmo.renameDevice("channel 5", "channel 3");
+    updates[0].value = 10;
+    CHECK(3 == fauxmo.setStates(updates, 4));
+    CHECK(5 == updates[0].id);
+    fauxmo.getState((uint16_t) 5, &state);
+    CHECK(10 == state.value);
+
+    // Color modes
+    fauxmoesp_update_t color = {};
+    color.id = 1;
+    color.fields = FAUXMO_CHANGE_XY;
+    color.x = 20000;
+    color.y = 20000;
+    CHECK(1 == fauxmo.setStates(&color, 1));
+    fauxmo.getState((uint16_t) 1, &state);
+    CHECK(('x' == state.mode) && (20000 == state.x) && (state.sat > 0));
+    color.fields = FAUXMO_CHANGE_CT;
+    color.colorTemp = 300;
+    fauxmo.setStates(&color, 1);
+    fauxmo.getState((uint16_t) 1, &state);
+    CHECK(('c' == state.mode) && (300 == state.colorTemp));
+
+    // Entries of the same device end as if applied one after the other
+    fauxmoesp_update_t order[2] = {};
+    order[0].id = 2;
+    order[0].fields = FAUXMO_CHANGE_XY;
+    order[0].x = 20000;
+    order[0].y = 20000;
+    order[1].id = 2;
+    order[1].fields = FAUXMO_CHANGE_HUE;
+    order[1].hue = 3000;
+    order[1].sat = 100;
+    fauxmo.setStates(order, 2);
+    fauxmo.getState((uint16_t) 2, &state);
+    CHECK(('h' == state.mode) && (3000 == state.hue) && (100 == state.sat) && (20000 == state.x));
+
+    // The other way round, xy sets hue and saturation over the ones requested before
+    fauxmoesp_state_t xy;
+    fauxmo.setStates(&order[0], 1);
+    fauxmo.getState((uint16_t) 2, &xy);
+    std::swap(order[0], order[1]);
+    order[0].id = order[1].id = 4;
+    fauxmo.setStates(order, 2);
+    fauxmo.getState((uint16_t) 4, &state);
+    CHECK(('x' == state.mode) && (xy.hue == state.hue) && (xy.sat == state.sat));
+
+    // A large batch with many entries per device, the last one of each wins
+    static fauxmoesp_update_t many[4096];
+    for (int i = 0; i < 4096; i++) {
+        many[i] = {};
+        many[i].id = i % 32;
+        many[i].fields = FAUXMO_CHANGE_VALUE;
+        many[i].value = i / 32;
+    }
+    CHECK(4096 == fauxmo.setStates(many, 4096));
+    for (uint16_t id = 0; id < 32; id++) {
+        fauxmo.getState(id, &state);
+        CHECK(127 == state.value);
+    }
+
+    // Removing a device keeps the marks in step with the devices
+    fauxmo.removeDevice((uint16_t) 0);
+    fauxmoesp_update_t last = {};
+    last.name = "channel 31";
+    last.fields = FAUXMO_CHANGE_VALUE;
+    last.value = 7;
+    CHECK(1 == fauxmo.setStates(&last, 1));
+    CHECK(30 == last.id);
+    fauxmo.getState((uint16_t) 30, &state);
+    CHECK(7 == state.value);
+
+    CHECK(0 == fauxmo.setStates(NULL, 4));
+
+    return TEST_RESULT();
+
+}
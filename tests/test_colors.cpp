@@ -0,0 +1,167 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// Fixed-point color conversions against a floating point reference
+
+#include "test.h"
+#include <math.h>
+#include <algorithm>
+
+static int _error(int a, double b) {
+    return abs(a - (int) lround(b));
+}
+
+// Hue API 0..254 to 0..255, the same way the library scales it
+static double _scale(int v) {
+    return (v >= 254) ? 255 : v + (v >> 7);
+}
+
+static void testHueSat() {
+
+    int worst = 0;
+    for (int h = 0; h < 65536; h += 97) {
+        for (int s = 0; s <= 254; s += 7) {
+            for (int v = 0; v <= 254; v += 31) {
+                double H = h / 65536.0 * 6, S = _scale(s) / 255.0, V = _scale(v);
+                int i = (int) H;
+                double f = H - i;
+                double p = V * (1 - S), q = V * (1 - S * f), t = V * (1 - S * (1 - f));
+                double r, g, b;
+                switch (i % 6) {
+                    case 0: r = V; g = t; b = p; break;
+                    case 1: r = q; g = V; b = p; break;
+                    case 2: r = p; g = V; b = t; break;
+                    case 3: r = p; g = q; b = V; break;
+                    case 4: r = t; g = p; b = V; break;
+                    default: r = V; g = p; b = q; break;
+                }
+                fauxmo_rgb_t rgb = fauxmo_hs2rgb(h, s, v);
+                worst = std::max(worst, std::max(_error(rgb.r, r), std::max(_error(rgb.g, g), _error(rgb.b, b))));
+            }
+        }
+    }
+    printf("hs2rgb: max error %d\n", worst);
+    CHECK(worst <= 2);
+
+}
+
+static void testRoundTrip() {
+
+    int worst = 0;
+    for (int r = 0; r < 256; r += 5) {
+        for (int g = 0; g < 256; g += 5) {
+            for (int b = 0; b < 256; b += 5) {
+                int top = std::max(r, std::max(g, b));
+                if (0 == top) continue;
+                fauxmo_rgb_t in = { (uint8_t) r, (uint8_t) g, (uint8_t) b };
+                uint16_t hue;
+                uint8_t sat;
+                fauxmo_rgb2hs(in, &hue, &sat);
+                fauxmo_rgb_t out = fauxmo_hs2rgb(hue, sat, 254);
+                double k = 255.0 / top;
+                worst = std::max(worst, std::max(_error(out.r, r * k), std::max(_error(out.g, g * k), _error(out.b, b * k))));
+            }
+        }
+    }
+    printf("rgb2hs2rgb: max error %d\n", worst);
+    CHECK(worst <= 2);
+
+}
+
+static void testXY() {
+
+    int worst = 0;
+    for (int x = 3000; x < 50000; x += 500) {
+        for (int y = 3000; y < 50000; y += 500) {
+            if (x + y > 65535) continue;
+            double X = x / 65535.0, Y = y / 65535.0, Z = 1 - X - Y;
+            double c[3] = {
+                X * 1.656492 - Y * 0.354851 - Z * 0.255038,
+                -X * 0.707196 + Y * 1.655397 + Z * 0.036152,
+                X * 0.051713 - Y * 0.121364 + Z * 1.011530
+            };
+            double top = 0;
+            for (int i = 0; i < 3; i++) {
+                if (c[i] < 0) c[i] = 0;
+                top = std::max(top, c[i]);
+            }
+            if (top <= 0) continue;
+            for (int i = 0; i < 3; i++) {
+                double v = c[i] / top;
+                v = (v <= 0.0031308) ? 12.92 * v : 1.055 * pow(v, 1 / 2.4) - 0.055;
+                c[i] = v * 255;
+            }
+            fauxmo_rgb_t rgb = fauxmo_xy2rgb(x, y, 254);
+            worst = std::max(worst, std::max(_error(rgb.r, c[0]), std::max(_error(rgb.g, c[1]), _error(rgb.b, c[2]))));
+        }
+    }
+    printf("xy2rgb: max error %d\n", worst);
+    CHECK(worst <= 1);
+
+}
+
+static void testColorTemp() {
+
+    // Warmer means less blue, and the range is clamped
+    fauxmo_rgb_t previous = fauxmo_ct2rgb(FAUXMO_COLOR_CT_MIN, 254);
+    for (int ct = FAUXMO_COLOR_CT_MIN + 1; ct <= FAUXMO_COLOR_CT_MAX; ct++) {
+        fauxmo_rgb_t rgb = fauxmo_ct2rgb(ct, 254);
+        CHECK(rgb.b <= previous.b);
+        previous = rgb;
+    }
+    fauxmo_rgb_t low = fauxmo_ct2rgb(0, 254), min = fauxmo_ct2rgb(FAUXMO_COLOR_CT_MIN, 254);
+    CHECK((low.r == min.r) && (low.g == min.g) && (low.b == min.b));
+
+}
+
+static void testBatch() {
+
+    // Batch and single conversions agree
+    uint16_t hue[64];
+    uint8_t sat[64], bri[64], out[64 * 4];
+    for (int i = 0; i < 64; i++) {
+        hue[i] = i * 1021;
+        sat[i] = 254 - i;
+        bri[i] = 3 * i;
+    }
+    fauxmo_hs2rgb_n(hue, sat, bri, out, 64, 4);
+    for (int i = 0; i < 64; i++) {
+        fauxmo_rgbw_t rgbw = fauxmo_rgb2rgbw(fauxmo_hs2rgb(hue[i], sat[i], bri[i]));
+        CHECK((out[4 * i] == rgbw.r) && (out[4 * i + 1] == rgbw.g) && (out[4 * i + 2] == rgbw.b) && (out[4 * i + 3] == rgbw.w));
+    }
+
+}
+
+int main() {
+    testHueSat();
+    testRoundTrip();
+    testXY();
+    testColorTemp();
+    testBatch();
+    return TEST_RESULT();
+}
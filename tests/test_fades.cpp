@@ -0,0 +1,131 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// Fade engine: transitiontime, setDefaultTransition and onFade, driven with hostAdvance()
+
+#include "test.h"
+#include <vector>
+
+static std::vector<fauxmoesp_frame_t> _frames;
+
+// Runs handle() one fade interval at a time until nothing is fading
+static void _runFades(fauxmoESP & fauxmo) {
+    for (int i = 0; (i < 1000) && fauxmo.isFading(); i++) {
+        hostAdvance(FAUXMO_FADE_INTERVAL);
+        fauxmo.handle();
+    }
+}
+
+static void _put(const char * body) {
+    hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/lights/1/state", body));
+}
+
+int main() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("kitchen");
+    fauxmo.setRateLimit(0);
+    fauxmo.onFade([](const fauxmoesp_frame_t * frames, size_t count) {
+        for (size_t i = 0; i < count; i++) _frames.push_back(frames[i]);
+    });
+    fauxmo.enable(true);
+
+    // One second at 20ms a frame, from 100 up to 200
+    _frames.clear();
+    unsigned long start = millis();
+    _put("{\"bri\": 200, \"transitiontime\": 10}");
+    CHECK(fauxmo.isFading());
+    _runFades(fauxmo);
+    unsigned long duration = millis() - start;
+    CHECK((_frames.size() >= 1000 / FAUXMO_FADE_INTERVAL) && (_frames.size() <= 1000 / FAUXMO_FADE_INTERVAL + 1));
+    CHECK((duration >= 1000) && (duration < 1000 + 2 * FAUXMO_FADE_INTERVAL));
+    bool monotonic = true;
+    for (size_t i = 0; i < _frames.size(); i++) {
+        monotonic &= (0 == _frames[i].id) && _frames[i].state;
+        if (i > 0) monotonic &= (_frames[i].value >= _frames[i - 1].value);
+    }
+    CHECK(monotonic);
+    CHECK((_frames.front().value > 100) && (_frames.front().value < 110));
+    CHECK(200 == _frames.back().value);
+
+    // Without transitiontime the change gets a single, final frame
+    _frames.clear();
+    _put("{\"hue\": 65000, \"sat\": 200}");
+    _runFades(fauxmo);
+    CHECK((1 == _frames.size()) && (65000 == _frames[0].hue));
+
+    // Hue takes the short way around the circle, through 0
+    _frames.clear();
+    _put("{\"hue\": 1000, \"sat\": 200, \"transitiontime\": 5}");
+    _runFades(fauxmo);
+    CHECK(_frames.size() > 10);
+    bool shortest = true;
+    for (auto & frame : _frames) shortest &= (frame.hue >= 65000) || (frame.hue <= 1000);
+    CHECK(shortest);
+    CHECK(1000 == _frames.back().hue);
+
+    // Fading out keeps the light on until the last frame
+    _frames.clear();
+    _put("{\"on\": false, \"transitiontime\": 5}");
+    _runFades(fauxmo);
+    CHECK(_frames.size() > 10);
+    bool on = true;
+    for (size_t i = 0; i + 1 < _frames.size(); i++) on &= _frames[i].state;
+    CHECK(on);
+    CHECK(!_frames.back().state && (0 == _frames.back().value));
+    bool decreasing = true;
+    for (size_t i = 1; i < _frames.size(); i++) decreasing &= (_frames[i].value <= _frames[i - 1].value);
+    CHECK(decreasing);
+
+    // The default transition applies to requests without transitiontime
+    fauxmo.setDefaultTransition(2);
+    _frames.clear();
+    _put("{\"on\": true, \"bri\": 50}");
+    _runFades(fauxmo);
+    CHECK((_frames.size() >= 200 / FAUXMO_FADE_INTERVAL) && (_frames.size() <= 200 / FAUXMO_FADE_INTERVAL + 1));
+    CHECK(_frames.back().state && (50 == _frames.back().value));
+    fauxmo.setDefaultTransition(0);
+
+    // setState stops the fade, nothing else is emitted
+    _frames.clear();
+    _put("{\"bri\": 250, \"transitiontime\": 10}");
+    hostAdvance(FAUXMO_FADE_INTERVAL);
+    fauxmo.handle();
+    CHECK(1 == _frames.size());
+    fauxmo.setState((uint16_t) 0, true, 20);
+    CHECK(!fauxmo.isFading());
+    hostAdvance(FAUXMO_FADE_INTERVAL);
+    fauxmo.handle();
+    CHECK(1 == _frames.size());
+    fauxmoesp_state_t state;
+    fauxmo.getState((uint16_t) 0, &state);
+    CHECK(state.state && (20 == state.value));
+
+    return TEST_RESULT();
+
+}
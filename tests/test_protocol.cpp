@@ -0,0 +1,485 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// Requests through the host AsyncTCP/WiFiUDP stand-ins, the way Alexa sends them
+
+#include "test.h"
+
+static void testDiscovery() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("kitchen");
+    fauxmo.addDevice("hall", FAUXMO_DEVICE_ONOFF);
+    fauxmo.enable(true);
+
+    WiFiUDP * udp = WiFiUDP::find(FAUXMO_UDP_MULTICAST_PORT);
+    CHECK(udp != NULL);
+    if (!udp) return;
+
+    udp->inject(HOST_SSDP_SEARCH, strlen(HOST_SSDP_SEARCH), IPAddress(192, 168, 1, 20), 50000);
+    fauxmo.handle();
+    CHECK(udp->sent.size() == 1);
+    if (udp->sent.size() == 1) {
+        CHECK(udp->sent[0].port == 50000);
+        CHECK(udp->sent[0].data.find("LOCATION: http://127.0.0.1:1901/description.xml") != std::string::npos);
+    }
+
+    // Not a search
+    udp->sent.clear();
+    const char * notify = "NOTIFY * HTTP/1.1\r\nNT: upnp:rootdevice\r\n\r\n";
+    udp->inject(notify, strlen(notify));
+    fauxmo.handle();
+    CHECK(udp->sent.empty());
+
+    std::string response = hostRequest(FAUXMO_TCP_PORT, hostHttp("GET", "/description.xml"));
+    CHECK(response.find("200 OK") != std::string::npos);
+    CHECK(response.find("<URLBase>http://127.0.0.1:1901/</URLBase>") != std::string::npos);
+
+    std::string lights = hostBody(hostRequest(FAUXMO_TCP_PORT, hostHttp("GET", "/api/2WLEDHardQrI3WHYTHoMcXHgEspsM8ZZRpSKtBQr/lights")));
+    CHECK(lights.find("\"1\":{\"type\": \"Extended color light\",\"name\": \"kitchen\"") != std::string::npos);
+    CHECK(lights.find("\"2\":{\"type\": \"On/Off plug-in unit\",\"name\": \"hall\"") != std::string::npos);
+
+    std::string light = hostBody(hostRequest(FAUXMO_TCP_PORT, hostHttp("GET", "/api/2WLEDHardQrI3WHYTHoMcXHgEspsM8ZZRpSKtBQr/lights/1")));
+    CHECK(light.find("\"state\":{\"on\": true,\"bri\": 100") != std::string::npos);
+
+    CHECK(AsyncClient::count() == 0);
+
+}
+
+static void testControl() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("kitchen");
+    fauxmo.enable(true);
+
+    int calls = 0;
+    fauxmo.onSetState([&calls](uint16_t id, const char * name, bool state, unsigned char value) {
+        calls++;
+        CHECK((0 == id) && state && (128 == value));
+    });
+
+    std::string response = hostBody(hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/lights/1/state", "{\"on\": true, \"bri\": 128}")));
+    CHECK(response.find("\"success\"") != std::string::npos);
+    CHECK(1 == calls);
+
+    fauxmoesp_state_t state;
+    CHECK(fauxmo.getState((uint16_t) 0, &state));
+    CHECK(state.state && (128 == state.value));
+
+    fauxmoesp_changed_t changes[4];
+    CHECK(1 == fauxmo.consumeChanges(changes, 4));
+    CHECK((0 == changes[0].id) && (changes[0].fields & FAUXMO_CHANGE_VALUE));
+
+    // Unknown light
+    hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/lights/9/state", "{\"on\": true}"));
+    CHECK(1 == calls);
+
+}
+
+static void testUnsupportedFields() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("plug", FAUXMO_DEVICE_ONOFF);
+    fauxmo.enable(true);
+
+    // A plug ignores bri, the request changes nothing
+    for (int i = 0; i < 5; i++) {
+        hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/lights/1/state", "{\"bri\": 100}"));
+    }
+    fauxmoesp_changed_t changes[8];
+    CHECK(0 == fauxmo.getGeneration());
+    CHECK(0 == fauxmo.consumeChanges(changes, 8));
+
+    // Nor does a body without any known field
+    hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/lights/1/state", "{\"alert\": \"select\"}"));
+    CHECK(0 == fauxmo.consumeChanges(changes, 8));
+
+    hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/lights/1/state", "{\"on\": false, \"bri\": 100}"));
+    CHECK(1 == fauxmo.getGeneration());
+    CHECK(1 == fauxmo.consumeChanges(changes, 8));
+    CHECK((0 == changes[0].id) && (FAUXMO_CHANGE_STATE == changes[0].fields));
+
+    // Removing the device leaves nothing behind
+    fauxmo.removeDevice("plug");
+    CHECK(0 == fauxmo.consumeChanges(changes, 8));
+
+}
+
+static void testGroups() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("lamp");
+    fauxmo.addDevice("plug", FAUXMO_DEVICE_ONOFF);
+    fauxmo.addDevice("fan", FAUXMO_DEVICE_ONOFF);
+    unsigned char room = fauxmo.addGroup("room");
+    fauxmo.addDeviceToGroup(room, 0);
+    fauxmo.addDeviceToGroup(room, 1);
+    fauxmo.enable(true);
+
+    std::string groups = hostBody(hostRequest(FAUXMO_TCP_PORT, hostHttp("GET", "/api/user/groups")));
+    CHECK(groups.find("\"1\":{") != std::string::npos);
+    CHECK(groups.find("\"name\": \"room\"") != std::string::npos);
+    CHECK(groups.find("[\"1\",\"2\"]") != std::string::npos);
+    std::string group = hostBody(hostRequest(FAUXMO_TCP_PORT, hostHttp("GET", "/api/user/groups/1")));
+    CHECK(group.find("\"name\": \"room\"") != std::string::npos);
+
+    int calls = 0;
+    fauxmoesp_change_t last = {};
+    fauxmo.onSetGroupState([&calls, &last](unsigned char id, const char * name, const uint32_t * members, size_t words,
+        unsigned char fields, bool state, unsigned char value, uint16_t hue, unsigned char sat, uint16_t colorTemp) {
+        calls++;
+        CHECK((0 == id) && (strcmp(name, "room") == 0));
+        CHECK((words > 0) && (0x3 == members[0]));
+        last.fields = fields;
+        last.state = state;
+        last.value = value;
+        last.hue = hue;
+        last.sat = sat;
+    });
+
+    // The callback gets the change requested, not the state of one of the members
+    std::string response = hostBody(hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/groups/1/action", "{\"on\": true, \"bri\": 50, \"hue\": 20000, \"sat\": 200}")));
+    CHECK(response.find("\"success\"") != std::string::npos);
+    CHECK(1 == calls);
+    CHECK((FAUXMO_CHANGE_STATE | FAUXMO_CHANGE_VALUE | FAUXMO_CHANGE_HUE) == last.fields);
+    CHECK(last.state && (50 == last.value) && (20000 == last.hue) && (200 == last.sat));
+
+    // Every member got the change its type supports, the rest of the devices did not
+    fauxmoesp_state_t state;
+    fauxmo.getState((uint16_t) 0, &state);
+    CHECK(state.state && (50 == state.value) && (20000 == state.hue) && (200 == state.sat));
+    fauxmo.getState((uint16_t) 1, &state);
+    CHECK(state.state && (100 == state.value) && (1 == state.hue));
+
+    hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/groups/1/action", "{\"on\": false}"));
+    CHECK((FAUXMO_CHANGE_STATE == last.fields) && !last.state);
+    fauxmo.getState((uint16_t) 2, &state);
+    CHECK(state.state);
+    fauxmo.getState((uint16_t) 1, &state);
+    CHECK(!state.state);
+
+    // Unknown group
+    hostRequest(FAUXMO_TCP_PORT, hostHttp("PUT", "/api/user/groups/5/action", "{\"on\": true}"));
+    CHECK(2 == calls);
+
+}
+
+static void testBridges() {
+
+    fauxmoESP fauxmo;
+    fauxmo.setMaxDevicesPerBridge(2);
+    for (int i = 0; i < 5; i++) {
+        char name[8];
+        snprintf(name, sizeof(name), "dev %d", i);
+        fauxmo.addDevice(name, FAUXMO_DEVICE_ONOFF);
+    }
+    unsigned char all = fauxmo.addGroup("all");
+    for (uint16_t i = 0; i < 5; i++) fauxmo.addDeviceToGroup(all, i);
+    unsigned char first = fauxmo.addGroup("first");
+    fauxmo.addDeviceToGroup(first, 1);
+    fauxmo.enable(true);
+    CHECK(3 == fauxmo.getBridgeCount());
+
+    // One SSDP answer per bridge, each with its own port and bridge id
+    WiFiUDP * udp = WiFiUDP::find(FAUXMO_UDP_MULTICAST_PORT);
+    CHECK(udp != NULL);
+    if (!udp) return;
+    udp->inject(HOST_SSDP_SEARCH, strlen(HOST_SSDP_SEARCH), IPAddress(192, 168, 1, 20), 50000);
+    fauxmo.handle();
+    CHECK(3 == udp->sent.size());
+    std::vector<std::string> ids;
+    for (size_t i = 0; i < udp->sent.size(); i++) {
+        char location[64];
+        snprintf(location, sizeof(location), "LOCATION: http://127.0.0.1:%u/description.xml", (unsigned int) (FAUXMO_TCP_PORT + i));
+        CHECK(udp->sent[i].data.find(location) != std::string::npos);
+        size_t pos = udp->sent[i].data.find("hue-bridgeid: ");
+        CHECK(pos != std::string::npos);
+        if (pos != std::string::npos) ids.push_back(udp->sent[i].data.substr(pos + 14, 12));
+    }
+    CHECK((3 == ids.size()) && (ids[0] != ids[1]) && (ids[1] != ids[2]) && (ids[0] != ids[2]));
+
+    // Each bridge lists its own devices with local ids
+    std::string lights = hostBody(hostRequest(FAUXMO_TCP_PORT + 1, hostHttp("GET", "/api/user/lights")));
+    CHECK(lights.find("\"1\":{\"type\": \"On/Off plug-in unit\",\"name\": \"dev 2\"") != std::string::npos);
+    CHECK(lights.find("\"2\":{\"type\": \"On/Off plug-in unit\",\"name\": \"dev 3\"") != std::string::npos);
+    CHECK(lights.find("dev 1") == std::string::npos);
+    CHECK(lights.find("dev 4") == std::string::npos);
+    std::string light = hostBody(hostRequest(FAUXMO_TCP_PORT + 2, hostHttp("GET", "/api/user/lights/1")));
+    CHECK(light.find("\"name\": \"dev 4\"") != std::string::npos);
+    CHECK(hostBody(hostRequest(FAUXMO_TCP_PORT + 2, hostHttp("GET", "/api/user/lights/2"))).find("dev") == std::string::npos);
+
+    // Local light ids map to the devices of the bridge
+    hostRequest(FAUXMO_TCP_PORT + 2, hostHttp("PUT", "/api/user/lights/1/state", "{\"on\": false}"));
+    fauxmoesp_state_t state;
+    fauxmo.getState((uint16_t) 4, &state);
+    CHECK(!state.state);
+    fauxmo.getState((uint16_t) 0, &state);
+    CHECK(state.state);
+
+    // Groups are listed by the bridges hosting some of their members, with those members
+    std::string groups = hostBody(hostRequest(FAUXMO_TCP_PORT, hostHttp("GET", "/api/user/groups")));
+    CHECK(groups.find("\"name\": \"all\"") != std::string::npos);
+    CHECK(groups.find("\"name\": \"first\"") != std::string::npos);
+    groups = hostBody(hostRequest(FAUXMO_TCP_PORT + 1, hostHttp("GET", "/api/user/groups")));
+    CHECK(groups.find("\"name\": \"all\"") != std::string::npos);
+    CHECK(groups.find("[\"1\",\"2\"]") != std::string::npos);
+    CHECK(groups.find("\"name\": \"first\"") == std::string::npos);
+    CHECK(hostBody(hostRequest(FAUXMO_TCP_PORT + 1, hostHttp("GET", "/api/user/groups/2"))).find("first") == std::string::npos);
+
+    // A group action only changes the members of the bridge that got it
+    int calls = 0;
+    fauxmo.onSetGroupState([&calls](unsigned char id, const char * name, const uint32_t * members, size_t words,
+        unsigned char fields, bool state, unsigned char value, uint16_t hue, unsigned char sat, uint16_t colorTemp) {
+        calls++;
+        CHECK((words > 0) && (0x0C == members[0]));
+    });
+    hostRequest(FAUXMO_TCP_PORT + 1, hostHttp("PUT", "/api/user/groups/1/action", "{\"on\": false}"));
+    CHECK(1 == calls);
+    for (uint16_t i = 0; i < 4; i++) {
+        fauxmo.getState(i, &state);
+        CHECK(state.state == ((i < 2) ? true : false));
+    }
+    hostRequest(FAUXMO_TCP_PORT + 1, hostHttp("PUT", "/api/user/groups/2/action", "{\"on\": false}"));
+    CHECK(1 == calls);
+    fauxmo.getState((uint16_t) 1, &state);
+    CHECK(state.state);
+
+}
+
+static void testSegments() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("kitchen");
+    fauxmo.enable(true);
+
+    int calls = 0;
+    fauxmo.onSetState([&calls](uint16_t id, const char * name, bool state, unsigned char value) { calls++; });
+
+    // One byte at a time
+    std::string request = hostHttp("PUT", "/api/user/lights/1/state", "{\"on\": true, \"bri\": 20}");
+    AsyncClient * client = AsyncServer::find(FAUXMO_TCP_PORT)->accept();
+    CHECK(client != NULL);
+    if (!client) return;
+    for (size_t i = 0; i < request.size(); i++) {
+        client->receive(request.data() + i, 1);
+        CHECK((i + 1 == request.size()) == (calls > 0));
+    }
+    CHECK(client->output.find("200 OK") != std::string::npos);
+    client->disconnect();
+
+    // Over FAUXMO_TCP_MAX_REQUEST
+    client = AsyncServer::find(FAUXMO_TCP_PORT)->accept();
+    bool deleted = false;
+    client->watch(&deleted);
+    std::string large = "PUT /api/user/lights/1/state HTTP/1.1\r\nContent-Length: 4000\r\n\r\n" + std::string(4000, ' ');
+    for (size_t i = 0; (i < large.size()) && !deleted; i += 500) {
+        client->receive(large.data() + i, std::min((size_t) 500, large.size() - i));
+    }
+    CHECK(deleted);
+    CHECK(1 == fauxmo.getStats().tooLarge);
+
+}
+
+static void testAdmission() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("kitchen");
+    fauxmo.setMaxClientsPerIP(2);
+    fauxmo.setRateLimit(1, 2);
+    fauxmo.enable(true);
+    AsyncServer * server = AsyncServer::find(FAUXMO_TCP_PORT);
+
+    // Connections from the same IP
+    AsyncClient * a = server->accept(IPAddress(10, 0, 0, 1));
+    AsyncClient * b = server->accept(IPAddress(10, 0, 0, 1));
+    CHECK(a && b);
+    CHECK(NULL == server->accept(IPAddress(10, 0, 0, 1)));
+    CHECK(1 == fauxmo.getStats().tooManyPerIP);
+    AsyncClient * c = server->accept(IPAddress(10, 0, 0, 2));
+    CHECK(c != NULL);
+
+    // Requests over the burst, 2 plus 1 for the device
+    std::string request = hostHttp("GET", "/api/user/lights");
+    a->receive(request.data(), request.size());
+    b->receive(request.data(), request.size());
+    CHECK(a->output.find("200 OK") != std::string::npos);
+    CHECK(b->output.find("200 OK") != std::string::npos);
+    a->disconnect();
+    b->disconnect();
+    CHECK(!hostRequest(FAUXMO_TCP_PORT, request, IPAddress(10, 0, 0, 1)).empty());
+    CHECK(hostRequest(FAUXMO_TCP_PORT, request, IPAddress(10, 0, 0, 1)).empty());
+    CHECK(1 == fauxmo.getStats().rateLimited);
+    if (c) c->disconnect();
+
+    // Allowlist
+    fauxmo.addAllowedIP(IPAddress(10, 0, 0, 3));
+    CHECK(NULL == server->accept(IPAddress(10, 0, 0, 4)));
+    CHECK(1 == fauxmo.getStats().notAllowed);
+    CHECK(!hostRequest(FAUXMO_TCP_PORT, request, IPAddress(10, 0, 0, 3)).empty());
+
+    CHECK(AsyncClient::count() == 0);
+
+}
+
+static void testTimeouts() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("kitchen");
+    fauxmo.enable(true);
+    AsyncServer * server = AsyncServer::find(FAUXMO_TCP_PORT);
+
+    // Never sends anything
+    bool silent = false;
+    AsyncClient * client = server->accept();
+    client->watch(&silent);
+
+    // Headers but no body
+    bool partial = false;
+    client = server->accept();
+    client->watch(&partial);
+    client->receive("PUT /api/user/lights/1/state HTTP/1.1\r\nContent-Length: 20\r\n\r\n");
+
+    // Answered but left open
+    bool idle = false;
+    client = server->accept();
+    client->watch(&idle);
+    client->receive(hostHttp("GET", "/api/user/lights").c_str());
+
+    // The reaper only marks them, they are closed from their poll callback (the TCP task)
+    hostAdvance(FAUXMO_TCP_HEADER_TIMEOUT + 2 * FAUXMO_TIMER_TICK);
+    fauxmo.handle();
+    CHECK(!silent && !partial && !idle);
+    std::string answered = client->output;
+    AsyncClient::pollAll();
+    CHECK(silent && partial && !idle);
+
+    // Nothing is processed once expired, before the poll closes it
+    hostAdvance(FAUXMO_TCP_IDLE_TIMEOUT);
+    fauxmo.handle();
+    CHECK(!idle);
+    client->receive(hostHttp("GET", "/api/user/lights").c_str());
+    CHECK(answered == client->output);
+    AsyncClient::pollAll();
+    CHECK(idle);
+
+    fauxmoesp_stats_t stats = fauxmo.getStats();
+    CHECK((1 == stats.headerTimeouts) && (1 == stats.bodyTimeouts) && (1 == stats.idleTimeouts));
+    CHECK(AsyncClient::count() == 0);
+
+}
+
+static void testTimeoutDuringRequest() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("kitchen");
+    fauxmo.enable(true);
+    AsyncServer * server = AsyncServer::find(FAUXMO_TCP_PORT);
+
+    // On ESP32 handle() runs in another task than the request, here it runs from the
+    // callback, when the deadline of the client has already passed
+    fauxmo.onSetState([&fauxmo](uint16_t id, const char * name, bool state, unsigned char value) {
+        hostAdvance(FAUXMO_TCP_HEADER_TIMEOUT + 2 * FAUXMO_TIMER_TICK);
+        fauxmo.handle();
+    });
+
+    bool deleted = false;
+    AsyncClient * client = server->accept();
+    client->watch(&deleted);
+    client->receive(hostHttp("PUT", "/api/user/lights/1/state", "{\"on\": false}").c_str());
+    CHECK(!deleted);
+    if (deleted) return;
+    CHECK(client->output.find("200 OK") != std::string::npos);
+    CHECK(0 == fauxmo.getStats().headerTimeouts);
+
+    AsyncClient::pollAll();
+    CHECK(!deleted);
+
+    // Once answered it gets the idle deadline
+    hostAdvance(FAUXMO_TCP_IDLE_TIMEOUT + 2 * FAUXMO_TIMER_TICK);
+    fauxmo.handle();
+    AsyncClient::pollAll();
+    CHECK(deleted);
+    CHECK(1 == fauxmo.getStats().idleTimeouts);
+    CHECK(AsyncClient::count() == 0);
+
+}
+
+static void testBridgeLimit() {
+
+    // More devices than FAUXMO_MAX_BRIDGES bridges hold, the rest go to the last bridge
+    {
+        fauxmoESP fauxmo;
+        fauxmo.setMaxDevicesPerBridge(1);
+        for (int i = 0; i < 300; i++) {
+            char name[12];
+            snprintf(name, sizeof(name), "dev %d", i);
+            fauxmo.addDevice(name, FAUXMO_DEVICE_ONOFF);
+        }
+        fauxmo.enable(true);
+        CHECK(FAUXMO_MAX_BRIDGES == fauxmo.getBridgeCount());
+        CHECK(AsyncServer::find(FAUXMO_TCP_PORT + FAUXMO_MAX_BRIDGES - 1) != NULL);
+        CHECK(AsyncServer::find(FAUXMO_TCP_PORT + FAUXMO_MAX_BRIDGES) == NULL);
+
+        uint16_t port = FAUXMO_TCP_PORT + FAUXMO_MAX_BRIDGES - 1;
+        std::string light = hostBody(hostRequest(port, hostHttp("GET", "/api/user/lights/1")));
+        CHECK(light.find("\"name\": \"dev 15\"") != std::string::npos);
+        char url[32];
+        snprintf(url, sizeof(url), "/api/user/lights/%d", 300 - FAUXMO_MAX_BRIDGES + 1);
+        light = hostBody(hostRequest(port, hostHttp("GET", url)));
+        CHECK(light.find("\"name\": \"dev 299\"") != std::string::npos);
+    }
+
+    // No bridge port past 65535
+    {
+        fauxmoESP fauxmo;
+        fauxmo.setPort(65533);
+        fauxmo.setMaxDevicesPerBridge(1);
+        for (int i = 0; i < 5; i++) fauxmo.addDevice("dev", FAUXMO_DEVICE_ONOFF);
+        fauxmo.enable(true);
+        CHECK(3 == fauxmo.getBridgeCount());
+        CHECK(AsyncServer::find(65535) != NULL);
+        CHECK(AsyncServer::find(0) == NULL);
+        std::string lights = hostBody(hostRequest(65535, hostHttp("GET", "/api/user/lights")));
+        CHECK((lights.find("\"1\":") != std::string::npos) && (lights.find("\"3\":") != std::string::npos));
+    }
+
+}
+
+int main() {
+    testDiscovery();
+    testControl();
+    testUnsupportedFields();
+    testGroups();
+    testBridges();
+    testBridgeLimit();
+    testSegments();
+    testAdmission();
+    testTimeouts();
+    testTimeoutDuringRequest();
+    return TEST_RESULT();
+}
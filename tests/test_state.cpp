@@ -0,0 +1,81 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// Device state seqlock: a writer thread hammers a device while readers
+// check they never see a mix of two writes. Build with
+// -DFAUXMO_SANITIZE=thread to have TSan watch it too.
+
+#include "test.h"
+#include <thread>
+#include <atomic>
+
+#define WRITES      200000
+#define READERS     2
+
+int main() {
+
+    fauxmoESP fauxmo;
+    fauxmo.addDevice("a");
+    fauxmo.addDevice("b");
+
+    // Every write keeps value, hue and sat tied together
+    fauxmo.setState((uint16_t) 0, true, 0, 0, 0);
+    std::atomic<bool> done(false);
+    std::atomic<long> reads(0), torn(0);
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < READERS; i++) {
+        readers.push_back(std::thread([&]() {
+            fauxmoesp_state_t state;
+            while (!done) {
+                fauxmo.getState((uint16_t) 0, &state);
+                if ((state.value != (state.hue & 0x7F)) || (state.sat != (state.hue & 0x7F))) torn++;
+                reads++;
+            }
+        }));
+    }
+
+    // A second writer on another device, writers are serialized by the lock
+    std::thread other([&]() {
+        for (int i = 0; i < WRITES / 4; i++) fauxmo.setState((uint16_t) 1, i & 1, i & 0x7F);
+    });
+
+    for (int i = 0; i < WRITES; i++) {
+        fauxmo.setState((uint16_t) 0, true, i & 0x7F, i & 0x7F, i & 0x7F);
+    }
+    other.join();
+    done = true;
+    for (auto & reader : readers) reader.join();
+
+    printf("%d writes, %ld reads, %ld torn\n", WRITES, reads.load(), torn.load());
+    CHECK(0 == torn);
+    CHECK(fauxmo.getGeneration() == 0);     // application writes are not Hue changes
+
+    return TEST_RESULT();
+
+}
@@ -0,0 +1,137 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// State snapshots with fauxmoFileStorage
+
+#include "test.h"
+#include <unistd.h>
+
+class countingStorage : public fauxmoFileStorage {
+
+    public:
+
+        countingStorage(const char * path) : fauxmoFileStorage(path) {}
+        bool write(const uint8_t * buffer, size_t len) {
+            writes++;
+            return fauxmoFileStorage::write(buffer, len);
+        }
+        int writes = 0;
+
+};
+
+static bool sameState(fauxmoESP & fauxmo, const char * name, bool state, unsigned char value, uint16_t hue, unsigned char sat) {
+    fauxmoesp_state_t current;
+    if (!fauxmo.getState(name, &current)) return false;
+    return (current.state == state) && (current.value == value) && (current.hue == hue) && (current.sat == sat);
+}
+
+int main() {
+
+    char path[] = "/tmp/fauxmo_storage_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    unlink(path);
+
+    // Nothing to restore yet
+    {
+        countingStorage storage(path);
+        fauxmoESP fauxmo;
+        fauxmo.addDevice("kitchen");
+        fauxmo.setStorage(&storage);
+        CHECK(!fauxmo.restoreState());
+    }
+
+    // Writes are debounced
+    {
+        countingStorage storage(path);
+        fauxmoESP fauxmo;
+        fauxmo.addDevice("kitchen");
+        fauxmo.addDevice("hall");
+        fauxmo.setStorage(&storage, 1000);
+        fauxmo.setState("kitchen", true, 200, 1000, 100);
+        fauxmo.setState("hall", true, 50);
+        fauxmo.handle();
+        CHECK(0 == storage.writes);
+        hostAdvance(1000);
+        fauxmo.handle();
+        CHECK(1 == storage.writes);
+
+        // Same snapshot, not written again
+        fauxmo.setState("hall", true, 50);
+        hostAdvance(1000);
+        fauxmo.handle();
+        CHECK(1 == storage.writes);
+    }
+
+    // Restored by name, whatever the order of the devices
+    {
+        countingStorage storage(path);
+        fauxmoESP fauxmo;
+        fauxmo.addDevice("hall", FAUXMO_DEVICE_ONOFF);
+        fauxmo.addDevice("porch");
+        fauxmo.addDevice("kitchen");
+        fauxmo.setStorage(&storage);
+        int notified = 0;
+        fauxmo.onSetState([&notified](uint16_t id, const char * name, bool state, unsigned char value) { notified++; });
+        CHECK(fauxmo.restoreState());
+        CHECK(2 == notified);
+        CHECK(sameState(fauxmo, "kitchen", true, 200, 1000, 100));
+        CHECK(sameState(fauxmo, "hall", true, 50, 1, 1));
+        CHECK(sameState(fauxmo, "porch", true, 100, 1, 1));     // not in the snapshot, defaults
+
+        // Changes are reported with the fields of each device type
+        fauxmoesp_changed_t changes[4];
+        CHECK(2 == fauxmo.consumeChanges(changes, 4));
+        for (size_t i = 0; i < 2; i++) {
+            if (0 == changes[i].id) CHECK(FAUXMO_CHANGE_STATE == changes[i].fields);
+            if (2 == changes[i].id) CHECK(FAUXMO_CHANGE_ALL == changes[i].fields);
+        }
+    }
+
+    // Corrupted snapshot
+    {
+        FILE * f = fopen(path, "r+b");
+        CHECK(f != NULL);
+        if (f) {
+            fseek(f, 20, SEEK_SET);
+            fputc(0x5A, f);
+            fclose(f);
+        }
+        countingStorage storage(path);
+        fauxmoESP fauxmo;
+        fauxmo.addDevice("kitchen");
+        fauxmo.setStorage(&storage);
+        CHECK(!fauxmo.restoreState());
+        CHECK(sameState(fauxmo, "kitchen", true, 100, 1, 1));
+    }
+
+    unlink(path);
+    return TEST_RESULT();
+
+}
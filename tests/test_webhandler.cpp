@@ -0,0 +1,122 @@
+/*
+
+FAUXMO ESP
+
+Copyright (C) 2016-2020 by Xose Pérez <xose dot perez at gmail dot com>
+
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+*/
+
+// fauxmoWebHandler on the ESPAsyncWebServer stand-in (external server mode)
+
+#include "test.h"
+#include "fauxmoWebHandler.h"
+
+// Runs a request through the handler the way the server does: the body in
+// chunks of chunk bytes, then the request. Returns what fauxmoESP wrote.
+static std::string serve(fauxmoWebHandler & handler, AsyncWebServerRequest & request, const std::string & body, size_t chunk) {
+    for (size_t index = 0; index < body.size(); index += chunk) {
+        size_t len = std::min(chunk, body.size() - index);
+        handler.handleBody(&request, (uint8_t *) body.data() + index, len, index, body.size());
+    }
+    handler.handleRequest(&request);
+    std::string output = request.client()->output;
+    request.client()->output.clear();
+    return output;
+}
+
+static int count(const std::string & text, const char * what) {
+    int found = 0;
+    for (size_t pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos + 1)) found++;
+    return found;
+}
+
+int main() {
+
+    fauxmoESP fauxmo;
+    fauxmo.createServer(false);
+    fauxmo.addDevice("kitchen");
+    fauxmo.enable(true);
+
+    int calls = 0;
+    fauxmo.onSetState([&calls](uint16_t id, const char * name, bool state, unsigned char value) { calls++; });
+
+    fauxmoWebHandler handler(fauxmo);
+    AsyncClient client;
+
+    {
+        AsyncWebServerRequest request(&client, HTTP_GET, "/description.xml");
+        CHECK(handler.canHandle(&request));
+        AsyncWebServerRequest other(&client, HTTP_GET, "/index.html");
+        CHECK(!handler.canHandle(&other));
+    }
+
+    // A body split in chunks reaches fauxmoESP once and complete
+    {
+        std::string body = "{\"on\": true, \"bri\": 128}";
+        AsyncWebServerRequest request(&client, HTTP_PUT, "/api/user/lights/1/state", body.size());
+        std::string response = serve(handler, request, body, 5);
+        CHECK(1 == count(response, "HTTP/1.1 200"));
+        CHECK(response.find("\"success\"") != std::string::npos);
+        CHECK(0 == request.code());
+        CHECK(1 == calls);
+        fauxmoesp_state_t state;
+        fauxmo.getState((uint16_t) 0, &state);
+        CHECK(state.state && (128 == state.value));
+    }
+
+    // Bodies over FAUXMO_TCP_MAX_REQUEST are rejected without calling fauxmoESP
+    {
+        std::string body = "{\"on\": false, \"bri\": 10}" + std::string(FAUXMO_TCP_MAX_REQUEST, ' ');
+        AsyncWebServerRequest request(&client, HTTP_PUT, "/api/user/lights/1/state", body.size());
+        std::string response = serve(handler, request, body, 256);
+        CHECK(413 == request.code());
+        CHECK(response.empty());
+        CHECK(1 == calls);
+        fauxmoesp_state_t state;
+        fauxmo.getState((uint16_t) 0, &state);
+        CHECK(state.state && (128 == state.value));
+    }
+
+    // Bodies parsed as a form come as the "body" parameter, with no chunks
+    {
+        AsyncWebServerRequest request(&client, HTTP_PUT, "/api/user/lights/1/state", 11);
+        request.addParam("body", "{\"bri\": 20}", true);
+        std::string response = serve(handler, request, "", 1);
+        CHECK(1 == count(response, "HTTP/1.1 200"));
+        CHECK(0 == request.code());
+        CHECK(2 == calls);
+        fauxmoesp_state_t state;
+        fauxmo.getState((uint16_t) 0, &state);
+        CHECK(state.state && (20 == state.value));
+    }
+
+    // Requests fauxmoESP does not know get a 404 from the server
+    {
+        AsyncWebServerRequest request(&client, HTTP_GET, "/api/user/sensors/1");
+        serve(handler, request, "", 1);
+        CHECK(404 == request.code());
+    }
+
+    return TEST_RESULT();
+
+}